@@ -0,0 +1,57 @@
+#define _POSIX_C_SOURCE 200112L
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* This file calls the real allocator. */
+#undef malloc
+#undef calloc
+#undef realloc
+#undef free
+
+#include <stdlib.h>
+
+#include "alloccount.h"
+
+static unsigned long long allocs;
+static unsigned long long frees;
+
+void *
+count_malloc(size_t size) {
+    __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+
+    return malloc(size);
+}
+
+void *
+count_calloc(size_t nmemb, size_t size) {
+    __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+
+    return calloc(nmemb, size);
+}
+
+void *
+count_realloc(void *ptr, size_t size) {
+    __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+
+    return realloc(ptr, size);
+}
+
+void
+count_free(void *ptr) {
+    if(ptr)
+        __atomic_add_fetch(&frees, 1, __ATOMIC_RELAXED);
+
+    free(ptr);
+}
+
+unsigned long long
+alloccount_allocs(void) {
+    return __atomic_load_n(&allocs, __ATOMIC_RELAXED);
+}
+
+unsigned long long
+alloccount_frees(void) {
+    return __atomic_load_n(&frees, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,14 @@
+/* Counting allocator. A program built with -Dmalloc=count_malloc,
+ * -Dcalloc=count_calloc, -Drealloc=count_realloc and -Dfree=count_free
+ * sends its own allocations through these, which count them and pass them
+ * on to the C library. What libraries allocate themselves is not
+ * counted. */
+void *count_malloc(size_t size);
+void *count_calloc(size_t nmemb, size_t size);
+void *count_realloc(void *ptr, size_t size);
+void count_free(void *ptr);
+
+/* Calls made so far by every thread: malloc, calloc and realloc count as
+ * allocations, and free of anything but NULL as a free. */
+unsigned long long alloccount_allocs(void);
+unsigned long long alloccount_frees(void);
@@ -0,0 +1,133 @@
+/* Load test of the fetch pipeline.
+ *
+ * For every station count given on the command line, fetches that many
+ * stations over and over with trafikanten_get_departures_all, the way
+ * the fetch thread does, for a fixed time. Writes one tab-separated line
+ * per count: requests per second, request latency quantiles from the
+ * metrics histogram, and the CPU time this process spent per request.
+ * Meant to be pointed at bench/mockapi rather than the real API. */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <err.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/resource.h>
+
+#include "../metrics.h"
+#include "../strtab.h"
+#include "../trafikanten.h"
+
+static double
+cpu_seconds(void) {
+    struct rusage ru;
+    if(getrusage(RUSAGE_SELF, &ru) == -1)
+        err(1, "getrusage");
+
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static void
+run(int nstations, double min_time) {
+    struct station *stations = calloc(nstations, sizeof(*stations));
+    struct departure_query *queries = calloc(nstations, sizeof(*queries));
+    if(stations == NULL || queries == NULL)
+        err(1, "cannot allocate %d stations", nstations);
+
+    for(int i = 0; i < nstations; ++i) {
+        snprintf(stations[i].id, sizeof(stations[i].id), "%d", 3010000 + i);
+        queries[i].station = &stations[i];
+    }
+
+    /* One round to open the connections and grow the buffers. */
+    trafikanten_get_departures_all(queries, nstations);
+
+    struct trafikanten_stats before, after;
+    trafikanten_get_stats(&before);
+    metrics_reset();
+
+    double cpu = cpu_seconds();
+    unsigned long long start = metrics_clock();
+    double elapsed = 0;
+    int rounds = 0;
+
+    while(elapsed < min_time || rounds < 3) {
+        if(trafikanten_get_departures_all(queries, nstations) == -1)
+            errx(1, "trafikanten_get_departures_all failed");
+
+        ++rounds;
+        elapsed = (metrics_clock() - start) / 1e9;
+    }
+
+    cpu = cpu_seconds() - cpu;
+    trafikanten_get_stats(&after);
+
+    unsigned long long requests = after.requests - before.requests;
+    unsigned long long failed = after.failed - before.failed;
+
+    printf("%d\t%d\t%llu\t%llu\t%.3f\t%.1f\t%.2f\t%.2f\t%.2f\t%.1f\n",
+           nstations, rounds, requests, failed, elapsed, requests / elapsed,
+           metrics_quantile(METRICS_HTTP_REQUEST, 0.5) * 1e3,
+           metrics_quantile(METRICS_HTTP_REQUEST, 0.99) * 1e3,
+           metrics_quantile(METRICS_HTTP_REQUEST, 0.999) * 1e3,
+           requests ? cpu / requests * 1e6 : 0.);
+    fflush(stdout);
+
+    for(int i = 0; i < nstations; ++i) {
+        free(queries[i].deps);
+        free(queries[i].body);
+    }
+    free(queries);
+    free(stations);
+}
+
+static void
+usage(const char *argv0) {
+    fprintf(stderr, "usage: %s [-u api-url] [-t seconds] stations...\n", argv0);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char **argv) {
+    const char *url = "http://127.0.0.1:8765";
+    double min_time = 5;
+
+    int opt;
+    while((opt = getopt(argc, argv, "t:u:")) != -1) {
+        if(opt == 't')
+            min_time = atof(optarg);
+        else if(opt == 'u')
+            url = optarg;
+        else
+            usage(argv[0]);
+    }
+
+    if(optind == argc)
+        usage(argv[0]);
+
+    struct rlimit rl;
+    if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    if(trafikanten_init() == -1 || trafikanten_set_url(url) == -1)
+        errx(1, "cannot initialize HTTP library");
+
+    printf("stations\trounds\trequests\tfailed\tseconds\trequests_per_s\tp50_ms\tp99_ms\tp999_ms\tcpu_us_per_request\n");
+
+    for(int i = optind; i < argc; ++i) {
+        int n = atoi(argv[i]);
+        if(n < 1)
+            usage(argv[0]);
+
+        run(n, min_time);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,396 @@
+/* Throughput, allocation and peak memory benchmark for the JSON decoders
+ * and the encoder.
+ *
+ * Every fixture given on the command line is decoded over and over by each
+ * decoder, and encoded again from its tree, and one tab-separated line per
+ * fixture and decoder is written to
+ * stdout, so that runs can be compared between releases. json.c is built
+ * for this program with malloc, calloc, realloc and free renamed to the
+ * counting versions below. */
+
+#define _POSIX_C_SOURCE 199309L
+
+#undef malloc
+#undef calloc
+#undef realloc
+#undef free
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/resource.h>
+
+#include "../json.h"
+
+#define CHUNK_SIZE 4096
+
+void *bench_malloc(size_t size);
+void *bench_calloc(size_t nmemb, size_t size);
+void *bench_realloc(void *ptr, size_t size);
+void bench_free(void *ptr);
+
+/* Every block carries its size in front of it, so that free can tell how
+ * much memory went away. */
+union header {
+    size_t size;
+    long double align_float;
+    long long align_int;
+    void *align_ptr;
+};
+
+static unsigned long long allocs;
+static size_t live;
+static size_t peak;
+
+void *
+bench_malloc(size_t size) {
+    union header *h = malloc(sizeof(*h) + size);
+    if(h == NULL)
+        return NULL;
+
+    h->size = size;
+    ++allocs;
+    live += size;
+    if(live > peak)
+        peak = live;
+
+    return h + 1;
+}
+
+void *
+bench_calloc(size_t nmemb, size_t size) {
+    if(size && nmemb > (size_t)-1 / size)
+        return NULL;
+
+    void *ptr = bench_malloc(nmemb * size);
+    if(ptr)
+        memset(ptr, 0, nmemb * size);
+
+    return ptr;
+}
+
+void *
+bench_realloc(void *ptr, size_t size) {
+    if(ptr == NULL)
+        return bench_malloc(size);
+
+    union header *h = (union header *)ptr - 1;
+    size_t old = h->size;
+
+    h = realloc(h, sizeof(*h) + size);
+    if(h == NULL)
+        return NULL;
+
+    h->size = size;
+    ++allocs;
+    live += size - old;
+    if(live > peak)
+        peak = live;
+
+    return h + 1;
+}
+
+void
+bench_free(void *ptr) {
+    if(ptr == NULL)
+        return;
+
+    union header *h = (union header *)ptr - 1;
+    live -= h->size;
+    free(h);
+}
+
+struct fixture {
+    const char *path;
+    char *data;
+    size_t size;
+    char *scratch;
+    struct json_value *tree;
+};
+
+static double
+now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The arena, the parser and the binder of the decoder being measured.
+ * They are made anew for every fixture and decoder, so that their memory
+ * counts towards the peak of the decoder that uses them. */
+static struct json_arena *arena;
+static struct json_parser *parser;
+static struct json_binder *binder;
+
+/* Each decoder decodes the fixture once and releases the result, and
+ * returns the time spent doing so. */
+static double
+run_decode(struct fixture *f) {
+    double start = now();
+    struct json_value *j = json_decode(f->data);
+    if(j == NULL)
+        errx(1, "%s: json_decode failed", f->path);
+    json_free(j);
+
+    return now() - start;
+}
+
+static double
+run_arena(struct fixture *f) {
+    /* json_decode_arena unescapes in place, so it gets a fresh copy. */
+    memcpy(f->scratch, f->data, f->size + 1);
+
+    double start = now();
+    if(json_decode_arena(f->scratch, arena) == NULL)
+        errx(1, "%s: json_decode_arena failed", f->path);
+    json_arena_clear(arena);
+
+    return now() - start;
+}
+
+static double
+run_indexed(struct fixture *f) {
+    /* With an arena, it too unescapes in place. */
+    if(arena)
+        memcpy(f->scratch, f->data, f->size + 1);
+
+    double start = now();
+    struct json_value *j = json_decode_indexed(arena ? f->scratch : f->data, f->size, arena);
+    if(j == NULL)
+        errx(1, "%s: json_decode_indexed failed", f->path);
+    if(arena)
+        json_arena_clear(arena);
+    else
+        json_free(j);
+
+    return now() - start;
+}
+
+/* The parser is fed in chunks the size curl tends to deliver. */
+static double
+run_push(struct fixture *f) {
+    double start = now();
+
+    for(size_t off = 0; off < f->size; off += CHUNK_SIZE) {
+        size_t n = f->size - off < CHUNK_SIZE ? f->size - off : CHUNK_SIZE;
+        if(json_parser_feed(parser, f->data + off, n) == -1)
+            errx(1, "%s: json_parser_feed failed", f->path);
+    }
+
+    struct json_value *j = json_parser_finish(parser);
+    if(j == NULL)
+        errx(1, "%s: json_parser_finish failed", f->path);
+    if(arena)
+        json_arena_clear(arena);
+    else
+        json_free(j);
+
+    return now() - start;
+}
+
+/* json_bind with the departure schema of trafikanten.c, into a fixed
+ * set of records; on other documents it measures how fast unknown members
+ * are skipped. */
+struct bench_departure {
+    char line[8];
+    int direction;
+    char destination[64];
+    time_t arrival;
+};
+
+static struct bench_departure departures[4096];
+
+static void *
+bench_element(void *record, size_t index) {
+    record = record;
+
+    return index < sizeof(departures) / sizeof(departures[0]) ? &departures[index] : NULL;
+}
+
+static const struct json_field departure_fields[] = {
+    JSON_FIELD(struct bench_departure, destination, json_field_text, "DestinationName"),
+    JSON_FIELD(struct bench_departure, direction, json_field_int, "DirectionRef"),
+    JSON_FIELD(struct bench_departure, line, json_field_text, "LineRef"),
+    JSON_FIELD(struct bench_departure, arrival, json_field_time, "ExpectedArrivalTime"),
+};
+
+static struct json_schema departure_schema = {
+    .fields = departure_fields,
+    .nfields = sizeof(departure_fields) / sizeof(departure_fields[0]),
+};
+
+static const struct json_field departure_array = {
+    .type = json_field_array,
+    .schema = &departure_schema,
+    .element = bench_element,
+};
+
+static double
+run_bind(struct fixture *f) {
+    double start = now();
+    if(json_bind(f->data, &departure_array, NULL, NULL) == NULL)
+        errx(1, "%s: json_bind failed", f->path);
+
+    return now() - start;
+}
+
+/* The binder fed in chunks, as trafikanten.c feeds it from curl. */
+static double
+run_bind_push(struct fixture *f) {
+    double start = now();
+    json_binder_start(binder, &departure_array, NULL);
+
+    for(size_t off = 0; off < f->size; off += CHUNK_SIZE) {
+        size_t n = f->size - off < CHUNK_SIZE ? f->size - off : CHUNK_SIZE;
+        if(json_binder_feed(binder, f->data + off, n) == -1)
+            errx(1, "%s: json_binder_feed failed", f->path);
+    }
+
+    if(json_binder_finish(binder, NULL) == -1)
+        errx(1, "%s: json_binder_finish failed", f->path);
+
+    return now() - start;
+}
+
+/* Encodes the decoded fixture into a buffer that is kept between runs,
+ * as a program that writes the same kind of document over and over
+ * would. */
+static struct json_buffer encoded;
+
+static double
+run_encode(struct fixture *f) {
+    double start = now();
+    encoded.size = 0;
+    if(json_encode(&encoded, f->tree) == -1)
+        err(1, "%s: json_encode failed", f->path);
+
+    return now() - start;
+}
+
+static const struct decoder {
+    const char *name;
+    double (*run)(struct fixture *f);
+    int use_arena;
+} decoders[] = {
+    { "decode", run_decode, 0 },
+    { "arena", run_arena, 1 },
+    { "indexed", run_indexed, 0 },
+    { "indexed-arena", run_indexed, 1 },
+    { "push", run_push, 0 },
+    { "push-arena", run_push, 1 },
+    { "bind", run_bind, 0 },
+    { "bind-push", run_bind_push, 0 },
+    { "encode", run_encode, 0 },
+};
+
+static void
+load_fixture(struct fixture *f, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if(file == NULL)
+        err(1, "cannot open \"%s\"", path);
+
+    if(fseek(file, 0, SEEK_END) == -1)
+        err(1, "cannot seek in \"%s\"", path);
+    long size = ftell(file);
+    if(size < 0 || fseek(file, 0, SEEK_SET) == -1)
+        err(1, "cannot seek in \"%s\"", path);
+
+    f->path = path;
+    f->size = size;
+    f->data = malloc(f->size + 1);
+    f->scratch = malloc(f->size + 1);
+    if(f->data == NULL || f->scratch == NULL)
+        err(1, "cannot allocate \"%s\"", path);
+
+    if(fread(f->data, 1, f->size, file) != f->size)
+        err(1, "cannot read \"%s\"", path);
+    f->data[f->size] = 0;
+
+    fclose(file);
+
+    if((f->tree = json_decode(f->data)) == NULL)
+        errx(1, "%s: json_decode failed", path);
+}
+
+static void
+usage(const char *argv0) {
+    fprintf(stderr, "usage: %s [-t seconds] fixture...\n", argv0);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char **argv) {
+    double min_time = 0.5;
+
+    int opt;
+    while((opt = getopt(argc, argv, "t:")) != -1) {
+        if(opt == 't')
+            min_time = atof(optarg);
+        else
+            usage(argv[0]);
+    }
+
+    if(optind == argc)
+        usage(argv[0]);
+
+    if(json_schema_compile(&departure_schema) == -1)
+        errx(1, "cannot compile departure schema");
+
+    fprintf(stderr, "json_decode_indexed engine: %s\n", json_engine());
+    printf("fixture\tdecoder\tbytes\titerations\tseconds\tmb_per_s\tallocs_per_doc\tpeak_bytes\n");
+
+    for(int i = optind; i < argc; ++i) {
+        struct fixture f;
+        load_fixture(&f, argv[i]);
+
+        const char *name = strrchr(f.path, '/') ? strrchr(f.path, '/') + 1 : f.path;
+
+        for(size_t d = 0; d < sizeof(decoders) / sizeof(decoders[0]); ++d) {
+            size_t base = live;
+            peak = live;
+
+            arena = decoders[d].use_arena ? json_arena_new(0) : NULL;
+            parser = json_parser_new(arena);
+            binder = json_binder_new();
+            if((decoders[d].use_arena && arena == NULL) || parser == NULL || binder == NULL)
+                err(1, "cannot allocate JSON parser");
+
+            /* One untimed run to grow the arena and the parser, so that
+             * the allocation count describes the steady state. */
+            decoders[d].run(&f);
+            allocs = 0;
+
+            double elapsed = 0;
+            unsigned long iterations = 0;
+            while(elapsed < min_time || iterations < 10) {
+                elapsed += decoders[d].run(&f);
+                ++iterations;
+            }
+
+            json_parser_free(parser);
+            json_binder_free(binder);
+            json_arena_free(arena);
+            json_buffer_free(&encoded);
+
+            printf("%s\t%s\t%zu\t%lu\t%.6f\t%.1f\t%.2f\t%zu\n",
+                   name, decoders[d].name, f.size, iterations, elapsed,
+                   f.size * iterations / elapsed / 1e6, (double)allocs / iterations, peak - base);
+            fflush(stdout);
+        }
+
+        json_free(f.tree);
+        free(f.data);
+        free(f.scratch);
+    }
+
+    struct rusage ru;
+    if(getrusage(RUSAGE_SELF, &ru) == 0)
+        fprintf(stderr, "maximum resident set size: %ld kB\n", ru.ru_maxrss);
+
+    return EXIT_SUCCESS;
+}
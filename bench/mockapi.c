@@ -0,0 +1,413 @@
+/* Stand-in for the Trafikanten real-time API, for load tests that must
+ * not touch the real one.
+ *
+ * Every GET /RealTime/GetRealTimeData/<station> is answered with the
+ * departures of a recorded response, repeated or cut to the requested
+ * number, and with every "/Date(ms+zone)/" moved so that the first
+ * departure is a minute away. Each answer is held back by a latency plus
+ * a random jitter, and a share of the requests is answered with 503
+ * instead. One thread serves every connection with poll(), keeping them
+ * alive between requests. */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#define REQUEST_PREFIX "/RealTime/GetRealTimeData/"
+#define MAX_REQUEST 8192
+
+/* A recorded departure, cut into the text around its timestamps. */
+struct record {
+    const char **text;
+    size_t *length;
+    long long *date;
+    int ndates;
+};
+
+struct buffer {
+    char *data;
+    size_t size;
+    size_t capacity;
+};
+
+struct connection {
+    int fd;
+    char request[MAX_REQUEST];
+    size_t received;
+    struct buffer response;
+    size_t sent;
+    long long due;
+};
+
+static struct record *records;
+static int nrecords;
+static long long first_date;
+
+static int latency;
+static int jitter;
+static double error_rate;
+static int departures;
+
+static long long
+now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static void
+append(struct buffer *b, const char *data, size_t size) {
+    if(b->size + size > b->capacity) {
+        size_t capacity = b->capacity ? b->capacity : 4096;
+        while(capacity < b->size + size)
+            capacity *= 2;
+
+        char *grown = realloc(b->data, capacity);
+        if(grown == NULL)
+            err(1, "cannot allocate response");
+
+        b->data = grown;
+        b->capacity = capacity;
+    }
+
+    memcpy(b->data + b->size, data, size);
+    b->size += size;
+}
+
+static char *
+read_file(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if(f == NULL)
+        err(1, "cannot open \"%s\"", path);
+
+    struct buffer b = { NULL, 0, 0 };
+    char chunk[65536];
+    size_t n;
+    while((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+        append(&b, chunk, n);
+    if(ferror(f))
+        err(1, "cannot read \"%s\"", path);
+    fclose(f);
+
+    append(&b, "", 1);
+
+    return b.data;
+}
+
+/* Splits one departure object into the text between its dates. */
+static void
+add_record(const char *start, const char *end) {
+    struct record *grown = realloc(records, (nrecords + 1) * sizeof(*records));
+    if(grown == NULL)
+        err(1, "cannot allocate records");
+    records = grown;
+
+    struct record *r = &records[nrecords++];
+    memset(r, 0, sizeof(*r));
+
+    for(const char *c = start;;) {
+        const char *date = strstr(c, "Date(");
+        if(date == NULL || date >= end)
+            date = end;
+        else
+            date += 5;
+
+        r->text = realloc(r->text, (r->ndates + 1) * sizeof(*r->text));
+        r->length = realloc(r->length, (r->ndates + 1) * sizeof(*r->length));
+        r->date = realloc(r->date, (r->ndates + 1) * sizeof(*r->date));
+        if(r->text == NULL || r->length == NULL || r->date == NULL)
+            err(1, "cannot allocate records");
+
+        r->text[r->ndates] = c;
+        r->length[r->ndates] = date - c;
+
+        if(date == end)
+            break;
+
+        char *after;
+        r->date[r->ndates++] = strtoll(date, &after, 10);
+        if(first_date == 0)
+            first_date = r->date[r->ndates - 1];
+        c = after;
+    }
+}
+
+/* Finds the objects of the top-level array of a recorded response. */
+static void
+load_records(const char *path) {
+    const char *text = read_file(path);
+    const char *start = NULL;
+    int depth = 0;
+
+    for(const char *c = text; *c; ++c) {
+        if(*c == '"') {
+            for(++c; *c && *c != '"'; ++c)
+                if(*c == '\\' && c[1])
+                    ++c;
+            if(!*c)
+                break;
+        } else if(*c == '{' || *c == '[') {
+            if(++depth == 2 && *c == '{')
+                start = c;
+        } else if(*c == '}' || *c == ']') {
+            if(depth-- == 2 && start) {
+                add_record(start, c + 1);
+                start = NULL;
+            }
+        }
+    }
+
+    if(nrecords == 0)
+        errx(1, "no departures in \"%s\"", path);
+}
+
+static void
+departure_body(struct buffer *b) {
+    long long shift = (long long)time(NULL) * 1000 + 60000 - first_date;
+    int n = departures ? departures : nrecords;
+
+    append(b, "[", 1);
+
+    for(int i = 0; i < n; ++i) {
+        const struct record *r = &records[i % nrecords];
+        long long cycle = i / nrecords * 600000LL;
+
+        if(i)
+            append(b, ",", 1);
+
+        for(int j = 0; j <= r->ndates; ++j) {
+            append(b, r->text[j], r->length[j]);
+
+            if(j < r->ndates) {
+                char number[32];
+                int len = snprintf(number, sizeof(number), "%lld", r->date[j] + shift + cycle);
+                append(b, number, len);
+            }
+        }
+    }
+
+    append(b, "]", 1);
+}
+
+static void
+respond(struct connection *c, const char *status, const struct buffer *body) {
+    char header[256];
+    int len = snprintf(header, sizeof(header),
+                       "HTTP/1.1 %s\r\nContent-Type: application/json\r\nContent-Length: %zu\r\n\r\n",
+                       status, body ? body->size : 0);
+
+    c->response.size = 0;
+    c->sent = 0;
+    append(&c->response, header, len);
+    if(body)
+        append(&c->response, body->data, body->size);
+
+    c->due = now_ms() + latency + (jitter ? rand() % (jitter + 1) : 0);
+}
+
+/* Takes the next complete request out of the connection's input, if
+ * there is one, and prepares its response. */
+static void
+handle_request(struct connection *c) {
+    static struct buffer body;
+
+    char *end = NULL;
+    for(size_t i = 0; i + 3 < c->received; ++i) {
+        if(!memcmp(&c->request[i], "\r\n\r\n", 4)) {
+            end = &c->request[i + 4];
+            break;
+        }
+    }
+    if(end == NULL)
+        return;
+
+    if(strncmp(c->request, "GET " REQUEST_PREFIX, 4 + strlen(REQUEST_PREFIX)))
+        respond(c, "404 Not Found", NULL);
+    else if(error_rate > 0 && rand() < error_rate * ((double)RAND_MAX + 1))
+        respond(c, "503 Service Unavailable", NULL);
+    else {
+        body.size = 0;
+        departure_body(&body);
+        respond(c, "200 OK", &body);
+    }
+
+    c->received -= end - c->request;
+    memmove(c->request, end, c->received);
+}
+
+static void
+usage(const char *argv0) {
+    fprintf(stderr, "usage: %s [-p port] [-l latency-ms] [-j jitter-ms] [-e error-rate] [-n departures] recorded-response\n", argv0);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char **argv) {
+    int port = 8765;
+
+    int opt;
+    while((opt = getopt(argc, argv, "e:j:l:n:p:")) != -1) {
+        if(opt == 'e')
+            error_rate = atof(optarg);
+        else if(opt == 'j')
+            jitter = atoi(optarg);
+        else if(opt == 'l')
+            latency = atoi(optarg);
+        else if(opt == 'n')
+            departures = atoi(optarg);
+        else if(opt == 'p')
+            port = atoi(optarg);
+        else
+            usage(argv[0]);
+    }
+
+    if(optind != argc - 1 || latency < 0 || jitter < 0 || departures < 0)
+        usage(argv[0]);
+
+    load_records(argv[optind]);
+    srand(time(NULL));
+    signal(SIGPIPE, SIG_IGN);
+
+    /* A load test keeps a connection open for every station. */
+    struct rlimit rl;
+    if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    if(listener == -1)
+        err(1, "cannot create socket");
+
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if(bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(listener, 1024) == -1)
+        err(1, "cannot listen on port %d", port);
+    fcntl(listener, F_SETFL, O_NONBLOCK);
+
+    fprintf(stderr, "serving %d recorded departures on 127.0.0.1:%d\n", nrecords, port);
+
+    struct connection **conns = NULL;
+    struct pollfd *fds = NULL;
+    int nconns = 0;
+    int capacity = 0;
+
+    for(;;) {
+        if(capacity < nconns + 1) {
+            capacity = capacity ? capacity * 2 : 64;
+            conns = realloc(conns, capacity * sizeof(*conns));
+            fds = realloc(fds, capacity * sizeof(*fds));
+            if(conns == NULL || fds == NULL)
+                err(1, "cannot allocate connections");
+        }
+
+        long long now = now_ms();
+        int timeout = -1;
+
+        fds[0].fd = listener;
+        fds[0].events = POLLIN;
+        for(int i = 0; i < nconns; ++i) {
+            struct connection *c = conns[i];
+            fds[i + 1].fd = c->fd;
+            fds[i + 1].events = POLLIN;
+
+            if(c->sent < c->response.size) {
+                if(c->due <= now)
+                    fds[i + 1].events = POLLOUT;
+                else {
+                    fds[i + 1].events = 0;
+                    if(timeout == -1 || c->due - now < timeout)
+                        timeout = c->due - now;
+                }
+            }
+        }
+
+        if(poll(fds, nconns + 1, timeout) == -1 && errno != EINTR)
+            err(1, "poll");
+
+        int n = nconns;
+        for(int i = 0; i < n; ++i) {
+            struct connection *c = conns[i];
+            int done = 0;
+
+            if(fds[i + 1].revents & (POLLERR | POLLHUP | POLLNVAL))
+                done = 1;
+            else if(fds[i + 1].revents & POLLIN) {
+                ssize_t got = read(c->fd, c->request + c->received, sizeof(c->request) - c->received);
+                if(got <= 0)
+                    done = 1;
+                else
+                    c->received += got;
+            } else if(fds[i + 1].revents & POLLOUT) {
+                ssize_t put = write(c->fd, c->response.data + c->sent, c->response.size - c->sent);
+                if(put == -1 && errno != EAGAIN)
+                    done = 1;
+                else if(put > 0)
+                    c->sent += put;
+            }
+
+            if(!done && c->sent == c->response.size) {
+                c->response.size = c->sent = 0;
+                handle_request(c);
+                if(c->response.size == 0 && c->received == sizeof(c->request))
+                    done = 1;
+            }
+
+            if(done) {
+                close(c->fd);
+                free(c->response.data);
+                free(c);
+                conns[i] = NULL;
+            }
+        }
+
+        int kept = 0;
+        for(int i = 0; i < nconns; ++i)
+            if(conns[i])
+                conns[kept++] = conns[i];
+        nconns = kept;
+
+        if(fds[0].revents & POLLIN) {
+            int fd;
+            while((fd = accept(listener, NULL, NULL)) != -1) {
+                if(capacity < nconns + 2) {
+                    capacity *= 2;
+                    conns = realloc(conns, capacity * sizeof(*conns));
+                    fds = realloc(fds, capacity * sizeof(*fds));
+                    if(conns == NULL || fds == NULL)
+                        err(1, "cannot allocate connections");
+                }
+
+                struct connection *c = calloc(1, sizeof(*c));
+                if(c == NULL)
+                    err(1, "cannot allocate connection");
+
+                fcntl(fd, F_SETFL, O_NONBLOCK);
+                c->fd = fd;
+                conns[nconns++] = c;
+            }
+        }
+    }
+}
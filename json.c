@@ -1,126 +1,328 @@
 #include <ctype.h>
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#define JSON_HAVE_X86_SIMD 1
+#include <immintrin.h>
+#else
+#define JSON_HAVE_X86_SIMD 0
+#endif
+
 #include "json.h"
 
-static char *
-json_decode_string (const char **input)
+struct json_arena_block
 {
-  const char *c, *end;
-  unsigned int ch;
-  char *result, *o;
+  struct json_arena_block *next;
+  size_t size, used;
+  char data[];
+};
 
-  c = *input;
+struct json_arena
+{
+  struct json_arena_block *blocks;
+  size_t block_size;
+};
 
-  if (*c != '"')
+#define JSON_ARENA_ALIGN(size) (((size) + sizeof (double) - 1) & ~(sizeof (double) - 1))
+
+struct json_arena *
+json_arena_new (size_t block_size)
+{
+  struct json_arena *arena;
+
+  if (0 == (arena = calloc (1, sizeof (*arena))))
     return 0;
 
-  end = ++c;
+  arena->block_size = block_size ? block_size : 16384;
 
-  while (*end && *end != '"')
+  return arena;
+}
+
+static void *
+json_arena_alloc (struct json_arena *arena, size_t size)
+{
+  struct json_arena_block *block = arena->blocks;
+  void *result;
+
+  size = JSON_ARENA_ALIGN (size);
+
+  if (!block || block->used + size > block->size)
     {
-      if (*end == '\\' && *(end + 1))
-        end += 2;
-      else
-        ++end;
+      size_t block_size = arena->block_size;
+
+      if (block_size < size)
+        block_size = size;
+
+      if (0 == (block = malloc (sizeof (*block) + block_size)))
+        return 0;
+
+      block->next = arena->blocks;
+      block->size = block_size;
+      block->used = 0;
+      arena->blocks = block;
     }
 
-  result = malloc (end - c + 1);
+  result = block->data + block->used;
+  block->used += size;
 
-  if (!result)
-    return 0;
+  memset (result, 0, size);
 
-  o = result;
+  return result;
+}
 
-  ch = 0;
+void
+json_arena_clear (struct json_arena *arena)
+{
+  struct json_arena_block *block, *next;
+  size_t total = 0;
 
-  while (c != end)
+  if (!arena || !arena->blocks)
+    return;
+
+  /* Keep a single block, grown to what the last document needed, so that
+   * a steady stream of similar documents settles on one block each.  */
+  for (block = arena->blocks->next; block; block = next)
     {
-      switch (*c)
-        {
-        case '\\':
+      next = block->next;
+      total += block->size;
+      free (block);
+    }
 
-          ++c;
+  block = arena->blocks;
+  block->next = 0;
+  block->used = 0;
 
-          switch (*c++)
-            {
-            case '0': ch = strtol (c, (char **) &c, 8); break;
-            case '"': ch = '"'; break;
-            case '/': ch = '/'; break;
-            case 'a': ch = '\a'; break;
-            case 'b': ch = '\b'; break;
-            case 't': ch = '\t'; break;
-            case 'n': ch = '\n'; break;
-            case 'v': ch = '\v'; break;
-            case 'f': ch = '\f'; break;
-            case 'r': ch = '\r'; break;
-            case 'u': ch = strtol (c, (char **) &c, 16); break;
-            case '\\': ch = '\\'; break;
-            default:
-              break;
-            }
+  if (total)
+    {
+      arena->block_size = block->size + total;
+      arena->blocks = 0;
+      free (block);
+    }
+}
 
-          if (ch < 0x80)
-            *o++ = (ch);
-          else if (ch < 0x800)
-            {
-              *o++ = (0xc0 | (ch >> 6));
-              *o++ = (0x80 | (ch & 0x3f));
-            }
-          else if (ch < 0x10000)
-            {
-              *o++ = (0xe0 | (ch >> 12));
-              *o++ = (0x80 | ((ch >> 6) & 0x3f));
-              *o++ = (0x80 | (ch & 0x3f));
-            }
-          else if (ch < 0x200000)
-            {
-              *o++ = (0xf0 | (ch >> 18));
-              *o++ = (0x80 | ((ch >> 12) & 0x3f));
-              *o++ = (0x80 | ((ch >> 6) & 0x3f));
-              *o++ = (0x80 | (ch & 0x3f));
-            }
-          else if (ch < 0x4000000)
-            {
-              *o++ = (0xf8 | (ch >> 24));
-              *o++ = (0x80 | ((ch >> 18) & 0x3f));
-              *o++ = (0x80 | ((ch >> 12) & 0x3f));
-              *o++ = (0x80 | ((ch >> 6) & 0x3f));
-              *o++ = (0x80 | (ch & 0x3f));
-            }
-          else
-            {
-              *o++ = (0xfc | (ch >> 30));
-              *o++ = (0x80 | ((ch >> 24) & 0x3f));
-              *o++ = (0x80 | ((ch >> 18) & 0x3f));
-              *o++ = (0x80 | ((ch >> 12) & 0x3f));
-              *o++ = (0x80 | ((ch >> 6) & 0x3f));
-              *o++ = (0x80 | (ch & 0x3f));
-            }
+void
+json_arena_free (struct json_arena *arena)
+{
+  if (!arena)
+    return;
 
-          break;
+  json_arena_clear (arena);
+  free (arena->blocks);
+  free (arena);
+}
 
-        default:
+static void *
+json_alloc (struct json_arena *arena, size_t size)
+{
+  return arena ? json_arena_alloc (arena, size) : calloc (1, size);
+}
+
+#define JSON_BAD_ESCAPE 0xffffffffu
+
+static int
+json_hex_digit (char ch)
+{
+  if (ch >= '0' && ch <= '9')
+    return ch - '0';
+  if (ch >= 'a' && ch <= 'f')
+    return ch - 'a' + 10;
+  if (ch >= 'A' && ch <= 'F')
+    return ch - 'A' + 10;
+
+  return -1;
+}
+
+/* Decodes the escape sequence after the backslash at *c, reading no
+ * further than end.  \u takes exactly four hex digits and \0 up to three
+ * octal digits; a malformed \u yields JSON_BAD_ESCAPE.  */
+static unsigned int
+json_escape (const char **c, const char *end)
+{
+  unsigned int ch = 0;
+  int i, digit;
 
-          *o++ = *c++;
+  switch (*(*c)++)
+    {
+    case '0':
+      for (i = 0; i < 3 && *c != end && **c >= '0' && **c <= '7'; ++i)
+        ch = ch * 8 + (*(*c)++ - '0');
+      break;
+    case '"': ch = '"'; break;
+    case '/': ch = '/'; break;
+    case 'a': ch = '\a'; break;
+    case 'b': ch = '\b'; break;
+    case 't': ch = '\t'; break;
+    case 'n': ch = '\n'; break;
+    case 'v': ch = '\v'; break;
+    case 'f': ch = '\f'; break;
+    case 'r': ch = '\r'; break;
+    case 'u':
+      if (end - *c < 4)
+        return JSON_BAD_ESCAPE;
+      for (i = 0; i < 4; ++i)
+        {
+          if (0 > (digit = json_hex_digit ((*c)[i])))
+            return JSON_BAD_ESCAPE;
+          ch = ch * 16 + digit;
         }
+      *c += 4;
+      break;
+    case '\\': ch = '\\'; break;
+    default:
+      ch = (unsigned char) (*c)[-1];
+      break;
     }
 
-  if (*c == '"')
-    ++c;
+  return ch;
+}
+
+/* Writes ch to o as UTF-8, and returns the number of bytes written.  */
+static size_t
+json_utf8 (char *o, unsigned int ch)
+{
+  if (ch < 0x80)
+    {
+      o[0] = ch;
+      return 1;
+    }
+  else if (ch < 0x800)
+    {
+      o[0] = (0xc0 | (ch >> 6));
+      o[1] = (0x80 | (ch & 0x3f));
+      return 2;
+    }
+  else if (ch < 0x10000)
+    {
+      o[0] = (0xe0 | (ch >> 12));
+      o[1] = (0x80 | ((ch >> 6) & 0x3f));
+      o[2] = (0x80 | (ch & 0x3f));
+      return 3;
+    }
+  else if (ch < 0x200000)
+    {
+      o[0] = (0xf0 | (ch >> 18));
+      o[1] = (0x80 | ((ch >> 12) & 0x3f));
+      o[2] = (0x80 | ((ch >> 6) & 0x3f));
+      o[3] = (0x80 | (ch & 0x3f));
+      return 4;
+    }
+  else if (ch < 0x4000000)
+    {
+      o[0] = (0xf8 | (ch >> 24));
+      o[1] = (0x80 | ((ch >> 18) & 0x3f));
+      o[2] = (0x80 | ((ch >> 12) & 0x3f));
+      o[3] = (0x80 | ((ch >> 6) & 0x3f));
+      o[4] = (0x80 | (ch & 0x3f));
+      return 5;
+    }
+  else
+    {
+      o[0] = (0xfc | (ch >> 30));
+      o[1] = (0x80 | ((ch >> 24) & 0x3f));
+      o[2] = (0x80 | ((ch >> 18) & 0x3f));
+      o[3] = (0x80 | ((ch >> 12) & 0x3f));
+      o[4] = (0x80 | ((ch >> 6) & 0x3f));
+      o[5] = (0x80 | (ch & 0x3f));
+      return 6;
+    }
+}
+
+/* Writes the unescaped string into o, which may be c itself: no escape
+ * json_escape accepts is shorter than its UTF-8 encoding (the six bytes
+ * of \uXXXX give at most three, \0 and three octal digits at most two),
+ * so the output never overtakes the input.  Returns -1 on a malformed
+ * escape.  */
+static int
+json_unescape_into (char *o, const char *c, const char *end)
+{
+  unsigned int ch;
+
+  while (c != end)
+    {
+      if (*c == '\\' && c + 1 != end)
+        {
+          ++c;
+          if (JSON_BAD_ESCAPE == (ch = json_escape (&c, end)))
+            return -1;
+          o += json_utf8 (o, ch);
+        }
+      else
+        *o++ = *c++;
+    }
 
   *o = 0;
 
-  *input = c;
+  return 0;
+}
+
+static char *
+json_unescape (struct json_arena *arena, const char *c, const char *end)
+{
+  char *result;
+
+  if (0 == (result = arena ? json_arena_alloc (arena, end - c + 1) : malloc (end - c + 1)))
+    return 0;
+
+  if (json_unescape_into (result, c, end))
+    {
+      if (!arena)
+        free (result);
+
+      return 0;
+    }
+
+  return result;
+}
+
+/* With an arena, the input is writable and strings are unescaped in
+ * place rather than copied.  */
+static char *
+json_decode_string (const char **input, struct json_arena *arena)
+{
+  const char *c, *end;
+  char *result;
+  int quoted;
+
+  c = *input;
+
+  if (*c != '"')
+    return 0;
+
+  end = ++c;
+
+  while (*end && *end != '"')
+    {
+      if (*end == '\\' && *(end + 1))
+        end += 2;
+      else
+        ++end;
+    }
+
+  quoted = (*end == '"');
+
+  if (arena)
+    {
+      result = (char *) c;
+      if (json_unescape_into (result, c, end))
+        return 0;
+    }
+  else if (0 == (result = json_unescape (0, c, end)))
+    return 0;
+
+  if (quoted)
+    ++end;
+
+  *input = end;
 
   return result;
 }
 
 static struct json_value *
-json_decode_value (const char **input)
+json_decode_value (const char **input, struct json_arena *arena)
 {
   struct json_value *result = 0;
   const char *c;
@@ -133,7 +335,7 @@ json_decode_value (const char **input)
   if (!*c)
     return 0;
 
-  result = calloc (1, sizeof (*result));
+  result = json_alloc (arena, sizeof (*result));
 
   if (!result)
     return 0;
@@ -146,7 +348,13 @@ json_decode_value (const char **input)
   else if (*c == '"')
     {
       result->type = json_string;
-      result->v.string = json_decode_string (&c);
+      if (0 == (result->v.string = json_decode_string (&c, arena)))
+        {
+          if (!arena)
+            free (result);
+
+          return 0;
+        }
     }
   else if (*c == '[')
     {
@@ -173,7 +381,7 @@ json_decode_value (const char **input)
           if (!*c || *c == ']')
             break;
 
-          if (0 == (current = json_decode_value (&c)))
+          if (0 == (current = json_decode_value (&c, arena)))
             break;
 
           if (previous)
@@ -218,21 +426,31 @@ json_decode_value (const char **input)
           if (*c != '"')
             break;
 
-          if (0 == (name = json_decode_string (&c)))
+          if (0 == (name = json_decode_string (&c, arena)))
             break;
 
           while (*c && isspace (*c))
             ++c;
 
           if (*c != ':')
-            break;
+            {
+              if (!arena)
+                free (name);
+
+              break;
+            }
 
           ++c;
 
-          if (0 == (value = json_decode_value (&c)))
-            break;
+          if (0 == (value = json_decode_value (&c, arena)))
+            {
+              if (!arena)
+                free (name);
+
+              break;
+            }
 
-          if (0 == (current = calloc (1, sizeof (*current))))
+          if (0 == (current = json_alloc (arena, sizeof (*current))))
             break;
 
           current->name = name;
@@ -268,7 +486,9 @@ json_decode_value (const char **input)
     }
   else
     {
-      free (result);
+      if (!arena)
+        free (result);
+
       result = 0;
     }
 
@@ -280,7 +500,15 @@ json_decode_value (const char **input)
 struct json_value *
 json_decode (const char *string)
 {
-  return json_decode_value (&string);
+  return json_decode_value (&string, 0);
+}
+
+struct json_value *
+json_decode_arena (char *string, struct json_arena *arena)
+{
+  const char *c = string;
+
+  return json_decode_value (&c, arena);
 }
 
 void
@@ -332,109 +560,2217 @@ json_free (struct json_value *v)
   free (v);
 }
 
-static int
-json_print_string (const char *string)
+/* Structural-index engine.  The input is first classified 64 bytes at a
+ * time into bitmasks of quotes, backslashes, operators and whitespace,
+ * from which the positions of every structural character, string quote
+ * and scalar are collected.  The tree is then built from that index
+ * alone, so string ends are known without scanning for them.  Only the
+ * SIMD classifiers make this pay; the scalar one is there so that the
+ * engine runs everywhere, and is slower than json_decode.  */
+
+struct json_masks
 {
-  putchar ('"');
+  uint64_t quote, backslash, op, space;
+};
 
-  while (*string)
-    {
-      switch (*string)
-        {
-        case '\b': putchar ('\\'); putchar ('b'); break;
-        case '\f': putchar ('\\'); putchar ('f'); break;
-        case '\n': putchar ('\\'); putchar ('n'); break;
-        case '\r': putchar ('\\'); putchar ('r'); break;
-        case '\t': putchar ('\\'); putchar ('t'); break;
-        case '"':  putchar ('\\'); putchar ('"'); break;
-        case '\\': putchar ('\\'); putchar ('\\'); break;
+static void
+json_classify_scalar (const unsigned char *p, struct json_masks *m)
+{
+  unsigned int i;
 
-        default:
+  memset (m, 0, sizeof (*m));
 
-          if (iscntrl (*string))
-            printf ("\\x%x", *string);
-          else
-            putchar (*string);
+  for (i = 0; i < 64; ++i)
+    {
+      uint64_t bit = (uint64_t) 1 << i;
 
-          break;
+      switch (p[i])
+        {
+        case '"': m->quote |= bit; break;
+        case '\\': m->backslash |= bit; break;
+        case '{': case '}': case '[': case ']': case ':': case ',': m->op |= bit; break;
+        case ' ': case '\t': case '\n': case '\r': m->space |= bit; break;
+        default: break;
         }
-
-      ++string;
     }
-
-  putchar ('"');
-
-  return 0;
 }
 
-int
-json_print (const struct json_value *v)
+#if JSON_HAVE_X86_SIMD
+__attribute__ ((target ("sse2")))
+static void
+json_classify_sse2 (const unsigned char *p, struct json_masks *m)
 {
-  const struct json_node *n;
+  const __m128i quote = _mm_set1_epi8 ('"'), backslash = _mm_set1_epi8 ('\\');
+  const __m128i lower = _mm_set1_epi8 (0x20), open = _mm_set1_epi8 ('{'), close = _mm_set1_epi8 ('}');
+  const __m128i colon = _mm_set1_epi8 (':'), comma = _mm_set1_epi8 (',');
+  const __m128i sp = _mm_set1_epi8 (' '), tab = _mm_set1_epi8 ('\t');
+  const __m128i nl = _mm_set1_epi8 ('\n'), cr = _mm_set1_epi8 ('\r');
+  unsigned int i;
 
-  if (!v)
-    return printf ("<null>");
+  memset (m, 0, sizeof (*m));
 
-  switch (v->type)
+  for (i = 0; i < 4; ++i)
     {
-    case json_number:
+      __m128i v = _mm_loadu_si128 ((const __m128i *) (p + 16 * i));
+      /* '[' and ']' are '{' and '}' without the 0x20 bit.  */
+      __m128i l = _mm_or_si128 (v, lower);
+      __m128i op = _mm_or_si128 (_mm_or_si128 (_mm_cmpeq_epi8 (l, open), _mm_cmpeq_epi8 (l, close)),
+                                 _mm_or_si128 (_mm_cmpeq_epi8 (v, colon), _mm_cmpeq_epi8 (v, comma)));
+      __m128i space = _mm_or_si128 (_mm_or_si128 (_mm_cmpeq_epi8 (v, sp), _mm_cmpeq_epi8 (v, tab)),
+                                    _mm_or_si128 (_mm_cmpeq_epi8 (v, nl), _mm_cmpeq_epi8 (v, cr)));
+
+      m->quote |= (uint64_t) (uint16_t) _mm_movemask_epi8 (_mm_cmpeq_epi8 (v, quote)) << (16 * i);
+      m->backslash |= (uint64_t) (uint16_t) _mm_movemask_epi8 (_mm_cmpeq_epi8 (v, backslash)) << (16 * i);
+      m->op |= (uint64_t) (uint16_t) _mm_movemask_epi8 (op) << (16 * i);
+      m->space |= (uint64_t) (uint16_t) _mm_movemask_epi8 (space) << (16 * i);
+    }
+}
 
-      return printf ("%g", v->v.number);
+/* AVX2 looks each byte up by its two nibbles instead of comparing it
+ * with every character of a class.  A byte is an operator if the
+ * entries for its nibbles share one of the low three bits, and
+ * whitespace if they share one of the next two: bit 0 is [ ] { }, bit 1
+ * is ',', bit 2 is ':', bit 3 is ' ' and bit 4 is '\t', '\n' and '\r'.  */
+__attribute__ ((target ("avx2")))
+static void
+json_classify_avx2 (const unsigned char *p, struct json_masks *m)
+{
+  const __m256i low = _mm256_setr_epi8 (8, 0, 0, 0, 0, 0, 0, 0, 0, 16, 20, 1, 2, 17, 0, 0,
+                                        8, 0, 0, 0, 0, 0, 0, 0, 0, 16, 20, 1, 2, 17, 0, 0);
+  const __m256i high = _mm256_setr_epi8 (16, 0, 10, 4, 0, 1, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0,
+                                         16, 0, 10, 4, 0, 1, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i nibble = _mm256_set1_epi8 (0x0f), zero = _mm256_setzero_si256 ();
+  const __m256i quote = _mm256_set1_epi8 ('"'), backslash = _mm256_set1_epi8 ('\\');
+  const __m256i op = _mm256_set1_epi8 (0x07), space = _mm256_set1_epi8 (0x18);
+  unsigned int i;
+
+  memset (m, 0, sizeof (*m));
+
+  for (i = 0; i < 2; ++i)
+    {
+      __m256i v = _mm256_loadu_si256 ((const __m256i *) (p + 32 * i));
+      __m256i c = _mm256_and_si256 (_mm256_shuffle_epi8 (low, _mm256_and_si256 (v, nibble)),
+                                    _mm256_shuffle_epi8 (high, _mm256_and_si256 (_mm256_srli_epi16 (v, 4), nibble)));
+
+      m->quote |= (uint64_t) (uint32_t) _mm256_movemask_epi8 (_mm256_cmpeq_epi8 (v, quote)) << (32 * i);
+      m->backslash |= (uint64_t) (uint32_t) _mm256_movemask_epi8 (_mm256_cmpeq_epi8 (v, backslash)) << (32 * i);
+      m->op |= (uint64_t) (uint32_t) ~_mm256_movemask_epi8 (_mm256_cmpeq_epi8 (_mm256_and_si256 (c, op), zero)) << (32 * i);
+      m->space |= (uint64_t) (uint32_t) ~_mm256_movemask_epi8 (_mm256_cmpeq_epi8 (_mm256_and_si256 (c, space), zero)) << (32 * i);
+    }
+}
+#endif
 
-    case json_string:
+/* The classifier is picked once, before main runs and before any thread
+ * can decode, so the pointer is never written while it is in use.  */
+static void (*json_classify) (const unsigned char *, struct json_masks *) = json_classify_scalar;
 
-      return json_print_string (v->v.string);
+#if JSON_HAVE_X86_SIMD
+__attribute__ ((constructor))
+static void
+json_engine_init (void)
+{
+  __builtin_cpu_init ();
 
-    case json_boolean:
+  if (__builtin_cpu_supports ("avx2"))
+    json_classify = json_classify_avx2;
+  else if (__builtin_cpu_supports ("sse2"))
+    json_classify = json_classify_sse2;
+}
+#endif
 
-      return printf (v->v.boolean ? "true" : "false");
+const char *
+json_engine (void)
+{
+#if JSON_HAVE_X86_SIMD
+  if (json_classify == json_classify_avx2)
+    return "avx2";
 
-    case json_array:
+  if (json_classify == json_classify_sse2)
+    return "sse2";
+#endif
 
-      putchar ('[');
+  return "scalar";
+}
 
-      for (v = v->v.array; v; v = v->next)
-        {
-          if (-1 == json_print (v))
-            return -1;
+static uint64_t
+json_prefix_xor (uint64_t x)
+{
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+
+  return x;
+}
 
-          if (v->next)
-            putchar (',');
-        }
+#define JSON_INDEX_WINDOW 1024
 
-      putchar (']');
+struct json_index
+{
+  char *input;
+  size_t length;
+  struct json_arena *arena;
+
+  /* Classifier state carried from one 64-byte block to the next.  */
+  size_t block;
+  uint64_t in_string, escape_next, scalar_carry;
+
+  /* Offsets of structural characters, string quotes and scalar starts.
+   * The window is refilled as the tree builder consumes it, so the index
+   * never has to hold the whole document.  */
+  uint32_t pos[JSON_INDEX_WINDOW + 64];
+  size_t n, i;
+};
+
+/* Returns the characters of a block that follow an odd run of
+ * backslashes, and are thus escaped, without looking at the runs one by
+ * one.  *carry is set when the block ends in such a run, which escapes
+ * the first character of the next block.  */
+static uint64_t
+json_escaped (uint64_t backslash, uint64_t *carry)
+{
+  const uint64_t even = 0x5555555555555555ULL;
+  uint64_t follows, odd_starts, sum;
 
-      return 0;
+  backslash &= ~*carry;
+  follows = (backslash << 1) | *carry;
 
-    case json_object:
+  /* Adding a run's start to the run carries out of its end, at an even
+   * position for a run that starts at an odd one, and vice versa.  */
+  odd_starts = backslash & ~even & ~follows;
+  sum = odd_starts + backslash;
+  *carry = sum < backslash;
 
-      putchar ('{');
+  return (even ^ (sum << 1)) & follows;
+}
 
-      for (n = v->v.object; n; n = n->next)
-        {
-          if (-1 == json_print_string (n->name))
-            return -1;
+static void
+json_index_block (struct json_index *ix)
+{
+  const unsigned char *p = (const unsigned char *) ix->input + ix->block;
+  unsigned char tail[64];
+  struct json_masks m;
+  uint64_t quotes, strings, scalar, bits;
+  uint32_t *out;
+
+  /* The padding is whitespace, which is never indexed, so the tail
+   * needs no other care.  */
+  if (ix->length - ix->block < 64)
+    {
+      memset (tail, ' ', sizeof (tail));
+      memcpy (tail, p, ix->length - ix->block);
+      p = tail;
+    }
 
-          putchar (':');
+  json_classify (p, &m);
 
-          if (-1 == json_print (n->value))
-            return -1;
+  quotes = m.quote & ~json_escaped (m.backslash, &ix->escape_next);
+  strings = json_prefix_xor (quotes) ^ ix->in_string;
+  ix->in_string = (uint64_t) 0 - (strings >> 63);
 
-          if (n->next)
-            putchar (',');
-        }
+  scalar = ~(m.quote | m.op | m.space | strings);
+  bits = (m.op & ~strings) | quotes | (scalar & ~((scalar << 1) | ix->scalar_carry));
+  ix->scalar_carry = scalar >> 63;
 
-      putchar ('}');
+  for (out = ix->pos + ix->n; bits; bits &= bits - 1)
+    *out++ = ix->block + __builtin_ctzll (bits);
 
-      return 0;
+  ix->n = out - ix->pos;
+  ix->block += 64;
+}
+
+/* Makes sure the window has an unconsumed entry.  Returns 0 at the end of
+ * the document.  */
+static int
+json_index_fill (struct json_index *ix)
+{
+  if (ix->i < ix->n)
+    return 1;
+
+  ix->i = ix->n = 0;
+
+  while (ix->n < JSON_INDEX_WINDOW && ix->block < ix->length)
+    json_index_block (ix);
+
+  return ix->n != 0;
+}
+
+static char
+json_index_peek (struct json_index *ix)
+{
+  return json_index_fill (ix) ? ix->input[ix->pos[ix->i]] : 0;
+}
+
+/* With an arena, strings are unescaped in place like json_decode_arena
+ * does, starting from the first backslash, and a string without one
+ * only has its closing quote overwritten.  The quote was already
+ * indexed, so the classifier never sees the change.  */
+static char *
+json_index_string (struct json_index *ix)
+{
+  char *c, *end, *backslash;
+
+  c = ix->input + ix->pos[ix->i++] + 1;
+
+  if (!json_index_fill (ix))
+    return json_unescape (ix->arena, c, ix->input + ix->length);
+
+  end = ix->input + ix->pos[ix->i++];
+
+  if (!ix->arena)
+    return json_unescape (0, c, end);
+
+  if (0 != (backslash = memchr (c, '\\', end - c)))
+    return json_unescape_into (backslash, backslash, end) ? 0 : c;
+
+  *end = 0;
+
+  return c;
+}
+
+/* Integers of up to 18 digits, which is most numbers in practice, are
+ * exact as doubles and are converted here; anything else goes to
+ * strtod.  */
+static double
+json_index_number (const char *c)
+{
+  const char *d = c + (*c == '-');
+  uint64_t n = 0;
+  int digits;
+
+  for (digits = 0; digits < 18 && *d >= '0' && *d <= '9'; ++digits)
+    n = n * 10 + (*d++ - '0');
+
+  if (!digits || (*d >= '0' && *d <= '9') || *d == '.' || *d == 'e' || *d == 'E')
+    return strtod (c, 0);
+
+  return (*c == '-') ? -(double) n : (double) n;
+}
+
+static struct json_value *
+json_index_value (struct json_index *ix)
+{
+  struct json_value *result;
+  const char *c;
+
+  if (!json_index_fill (ix))
+    return 0;
+
+  c = ix->input + ix->pos[ix->i];
+
+  if (0 == (result = json_alloc (ix->arena, sizeof (*result))))
+    return 0;
+
+  if (isdigit (*c) || *c == '-')
+    {
+      ++ix->i;
+      result->type = json_number;
+      result->v.number = json_index_number (c);
+    }
+  else if (*c == '"')
+    {
+      result->type = json_string;
+      if (0 == (result->v.string = json_index_string (ix)))
+        {
+          if (!ix->arena)
+            free (result);
+
+          return 0;
+        }
+    }
+  else if (*c == '[')
+    {
+      struct json_value *previous = 0;
+      struct json_value *current = 0;
+
+      ++ix->i;
+
+      result->type = json_array;
+
+      for (;;)
+        {
+          if (previous)
+            {
+              if (json_index_peek (ix) != ',')
+                break;
+
+              ++ix->i;
+            }
+
+          if (!json_index_peek (ix) || json_index_peek (ix) == ']')
+            break;
+
+          if (0 == (current = json_index_value (ix)))
+            break;
+
+          if (previous)
+            previous->next = current;
+          else
+            result->v.array = current;
+
+          previous = current;
+        }
+
+      if (json_index_peek (ix) == ']')
+        ++ix->i;
+    }
+  else if (*c == '{')
+    {
+      struct json_node *previous = 0;
+      struct json_node *current = 0;
+
+      ++ix->i;
+
+      result->type = json_object;
+
+      for (;;)
+        {
+          char *name;
+          struct json_value *value;
+
+          if (previous)
+            {
+              if (json_index_peek (ix) != ',')
+                break;
+
+              ++ix->i;
+            }
+
+          if (json_index_peek (ix) != '"')
+            break;
+
+          if (0 == (name = json_index_string (ix)))
+            break;
+
+          if (json_index_peek (ix) != ':')
+            {
+              if (!ix->arena)
+                free (name);
+
+              break;
+            }
+
+          ++ix->i;
+
+          if (0 == (value = json_index_value (ix)))
+            {
+              if (!ix->arena)
+                free (name);
+
+              break;
+            }
+
+          if (0 == (current = json_alloc (ix->arena, sizeof (*current))))
+            {
+              if (!ix->arena)
+                {
+                  free (name);
+                  json_free (value);
+                }
+
+              break;
+            }
+
+          current->name = name;
+          current->value = value;
+
+          if (previous)
+            previous->next = current;
+          else
+            result->v.object = current;
+
+          previous = current;
+        }
+
+      if (json_index_peek (ix) == '}')
+        ++ix->i;
+    }
+  else if (!strncmp (c, "true", 4))
+    {
+      ++ix->i;
+      result->type = json_boolean;
+      result->v.boolean = 1;
+    }
+  else if (!strncmp (c, "false", 5))
+    {
+      ++ix->i;
+      result->type = json_boolean;
+      result->v.boolean = 0;
+    }
+  else if (!strncmp (c, "null", 4))
+    {
+      ++ix->i;
+      result->type = json_null;
+    }
+  else
+    {
+      if (!ix->arena)
+        free (result);
+
+      result = 0;
+    }
+
+  return result;
+}
+
+struct json_value *
+json_decode_indexed (char *string, size_t length, struct json_arena *arena)
+{
+  struct json_index ix;
+
+  ix.input = string;
+  ix.length = length;
+  ix.arena = arena;
+  ix.block = 0;
+  ix.in_string = ix.escape_next = ix.scalar_carry = 0;
+  ix.n = ix.i = 0;
+
+  if (ix.length >= UINT32_MAX)
+    return 0;
+
+  return json_index_value (&ix);
+}
+
+enum json_parser_state
+{
+  json_expect_value = 0,
+  json_expect_value_or_close,
+  json_expect_name_or_close,
+  json_expect_colon,
+  json_expect_comma_or_close,
+  json_done,
+  json_error
+};
+
+enum json_token
+{
+  json_no_token = 0,
+  json_string_token,
+  json_name_token,
+  json_number_token,
+  json_literal_token
+};
+
+struct json_frame
+{
+  struct json_value *container;
+  struct json_value *last_value;
+  struct json_node *last_node;
+};
+
+struct json_parser
+{
+  enum json_parser_state state;
+  enum json_token token;
+
+  /* Partial token carried over from the previous chunk.  */
+  char *scratch;
+  size_t scratch_size, scratch_alloc;
+  int escape;
+  const char *literal;
+  size_t literal_pos;
+
+  struct json_frame *stack;
+  size_t depth, stack_alloc;
+
+  char *name;
+  struct json_value *root;
+
+  struct json_arena *arena;
+};
+
+struct json_parser *
+json_parser_new (struct json_arena *arena)
+{
+  struct json_parser *p;
+
+  if (0 == (p = calloc (1, sizeof (*p))))
+    return 0;
+
+  p->arena = arena;
+
+  return p;
+}
+
+static void
+json_parser_reset (struct json_parser *p)
+{
+  if (!p->arena)
+    {
+      json_free (p->root);
+      free (p->name);
+    }
+
+  p->root = 0;
+  p->name = 0;
+  p->depth = 0;
+  p->scratch_size = 0;
+  p->token = json_no_token;
+  p->state = json_expect_value;
+}
+
+void
+json_parser_free (struct json_parser *p)
+{
+  if (!p)
+    return;
+
+  json_parser_reset (p);
+
+  free (p->scratch);
+  free (p->stack);
+  free (p);
+}
+
+/* Appends size bytes to a token carried over between chunks, keeping it
+ * NUL-terminated.  */
+static int
+json_save (char **scratch, size_t *scratch_size, size_t *scratch_alloc,
+           const char *data, size_t size)
+{
+  if (*scratch_size + size + 1 > *scratch_alloc)
+    {
+      size_t alloc = *scratch_alloc ? *scratch_alloc : 64;
+      char *grown;
+
+      while (alloc < *scratch_size + size + 1)
+        alloc *= 2;
+
+      if (0 == (grown = realloc (*scratch, alloc)))
+        return -1;
+
+      *scratch = grown;
+      *scratch_alloc = alloc;
+    }
+
+  memcpy (*scratch + *scratch_size, data, size);
+  *scratch_size += size;
+  (*scratch)[*scratch_size] = 0;
+
+  return 0;
+}
+
+static int
+json_parser_save (struct json_parser *p, const char *data, size_t size)
+{
+  return json_save (&p->scratch, &p->scratch_size, &p->scratch_alloc, data, size);
+}
+
+/* Attaches a finished value to the innermost open container, and opens
+ * it as a new container if it is an array or an object.  */
+static int
+json_parser_add (struct json_parser *p, struct json_value *value)
+{
+  struct json_frame *frame;
+
+  if (!p->depth)
+    p->root = value;
+  else
+    {
+      frame = &p->stack[p->depth - 1];
+
+      if (frame->container->type == json_array)
+        {
+          if (frame->last_value)
+            frame->last_value->next = value;
+          else
+            frame->container->v.array = value;
+
+          frame->last_value = value;
+        }
+      else
+        {
+          struct json_node *node;
+
+          if (0 == (node = json_alloc (p->arena, sizeof (*node))))
+            {
+              if (!p->arena)
+                json_free (value);
+
+              return -1;
+            }
+
+          node->name = p->name;
+          node->value = value;
+          p->name = 0;
+
+          if (frame->last_node)
+            frame->last_node->next = node;
+          else
+            frame->container->v.object = node;
+
+          frame->last_node = node;
+        }
+    }
+
+  if (value->type == json_array || value->type == json_object)
+    {
+      if (p->depth == p->stack_alloc)
+        {
+          size_t alloc = p->stack_alloc ? p->stack_alloc * 2 : 16;
+          struct json_frame *stack;
+
+          if (0 == (stack = realloc (p->stack, alloc * sizeof (*stack))))
+            return -1;
+
+          p->stack = stack;
+          p->stack_alloc = alloc;
+        }
+
+      frame = &p->stack[p->depth++];
+      frame->container = value;
+      frame->last_value = 0;
+      frame->last_node = 0;
+
+      p->state = (value->type == json_array)
+                 ? json_expect_value_or_close : json_expect_name_or_close;
+    }
+  else
+    p->state = p->depth ? json_expect_comma_or_close : json_done;
+
+  return 0;
+}
+
+static int
+json_parser_add_new (struct json_parser *p, enum json_value_type type, int boolean)
+{
+  struct json_value *value;
+
+  if (0 == (value = json_alloc (p->arena, sizeof (*value))))
+    return -1;
+
+  value->type = type;
+  value->v.boolean = boolean;
+
+  return json_parser_add (p, value);
+}
+
+static int
+json_parser_close (struct json_parser *p, char ch)
+{
+  enum json_value_type type;
+
+  if (!p->depth)
+    return -1;
+
+  type = p->stack[p->depth - 1].container->type;
+
+  if ((ch == ']') != (type == json_array))
+    return -1;
+
+  --p->depth;
+
+  p->state = p->depth ? json_expect_comma_or_close : json_done;
+
+  return 0;
+}
+
+static int
+json_parser_end_string (struct json_parser *p, char *string)
+{
+  struct json_value *value;
+
+  if (!string)
+    return -1;
+
+  if (p->token == json_name_token)
+    {
+      p->name = string;
+      p->state = json_expect_colon;
+
+      return 0;
+    }
+
+  if (0 == (value = json_alloc (p->arena, sizeof (*value))))
+    {
+      if (!p->arena)
+        free (string);
+
+      return -1;
+    }
+
+  value->type = json_string;
+  value->v.string = string;
+
+  return json_parser_add (p, value);
+}
+
+static int
+json_parser_end_number (struct json_parser *p)
+{
+  struct json_value *value;
+
+  if (0 == (value = json_alloc (p->arena, sizeof (*value))))
+    return -1;
+
+  value->type = json_number;
+  value->v.number = strtod (p->scratch, 0);
+
+  p->token = json_no_token;
+  p->scratch_size = 0;
+
+  return json_parser_add (p, value);
+}
+
+/* Continues the token in progress.  Returns the number of bytes consumed,
+ * or -1 on error.  */
+static long
+json_parser_token (struct json_parser *p, const char *data, const char *end)
+{
+  const char *c = data;
+
+  switch (p->token)
+    {
+    case json_string_token:
+    case json_name_token:
+
+      for (; c != end; ++c)
+        {
+          if (p->escape)
+            p->escape = 0;
+          else if (*c == '\\')
+            p->escape = 1;
+          else if (*c == '"')
+            break;
+        }
+
+      if (c == end)
+        return json_parser_save (p, data, c - data) ? -1 : c - data;
+
+      if (p->scratch_size)
+        {
+          if (json_parser_save (p, data, c - data))
+            return -1;
+
+          if (json_parser_end_string (p, json_unescape (p->arena, p->scratch, p->scratch + p->scratch_size)))
+            return -1;
+        }
+      else if (json_parser_end_string (p, json_unescape (p->arena, data, c)))
+        return -1;
+
+      p->token = json_no_token;
+      p->scratch_size = 0;
+
+      return c + 1 - data;
+
+    case json_number_token:
+
+      while (c != end && (isdigit (*c) || strchr ("+-.eE", *c)))
+        ++c;
+
+      if (json_parser_save (p, data, c - data))
+        return -1;
+
+      if (c != end && json_parser_end_number (p))
+        return -1;
+
+      return c - data;
+
+    case json_literal_token:
+
+      for (; c != end && p->literal[p->literal_pos]; ++c, ++p->literal_pos)
+        if (*c != p->literal[p->literal_pos])
+          return -1;
+
+      if (p->literal[p->literal_pos])
+        return c - data;
+
+      p->token = json_no_token;
+
+      return json_parser_add_new (p, (p->literal[0] == 'n') ? json_null : json_boolean,
+                                  p->literal[0] == 't') ? -1 : c - data;
+
+    default:
+
+      return -1;
+    }
+}
+
+static int
+json_parser_begin_value (struct json_parser *p, char ch)
+{
+  if (ch == '"')
+    {
+      p->token = json_string_token;
+      p->escape = 0;
+    }
+  else if (isdigit (ch) || ch == '-')
+    {
+      p->token = json_number_token;
+      return json_parser_save (p, &ch, 1);
+    }
+  else if (ch == '[')
+    return json_parser_add_new (p, json_array, 0);
+  else if (ch == '{')
+    return json_parser_add_new (p, json_object, 0);
+  else if (ch == 't' || ch == 'f' || ch == 'n')
+    {
+      p->token = json_literal_token;
+      p->literal = (ch == 't') ? "true" : (ch == 'f') ? "false" : "null";
+      p->literal_pos = 1;
+    }
+  else
+    return -1;
+
+  return 0;
+}
+
+int
+json_parser_feed (struct json_parser *p, const char *data, size_t size)
+{
+  const char *c = data, *end = data + size;
+
+  while (c != end && p->state != json_error)
+    {
+      long n;
+
+      if (p->token)
+        {
+          if (-1 == (n = json_parser_token (p, c, end)))
+            p->state = json_error;
+          else
+            c += n;
+
+          continue;
+        }
+
+      if (isspace (*c))
+        {
+          ++c;
+          continue;
+        }
+
+      switch (p->state)
+        {
+        case json_expect_value_or_close:
+
+          if (*c == ']')
+            {
+              if (json_parser_close (p, *c))
+                p->state = json_error;
+
+              break;
+            }
+
+          /* Fall through.  */
+
+        case json_expect_value:
+
+          if (json_parser_begin_value (p, *c))
+            p->state = json_error;
+
+          break;
+
+        case json_expect_name_or_close:
+
+          if (*c == '}')
+            {
+              if (json_parser_close (p, *c))
+                p->state = json_error;
+            }
+          else if (*c == '"')
+            {
+              p->token = json_name_token;
+              p->escape = 0;
+            }
+          else
+            p->state = json_error;
+
+          break;
+
+        case json_expect_colon:
+
+          p->state = (*c == ':') ? json_expect_value : json_error;
+
+          break;
+
+        case json_expect_comma_or_close:
+
+          if (*c == ',')
+            p->state = (p->stack[p->depth - 1].container->type == json_array)
+                       ? json_expect_value_or_close : json_expect_name_or_close;
+          else if (json_parser_close (p, *c))
+            p->state = json_error;
+
+          break;
+
+        default:
+
+          p->state = json_error;
+        }
+
+      ++c;
+    }
+
+  return (p->state == json_error) ? -1 : 0;
+}
+
+struct json_value *
+json_parser_finish (struct json_parser *p)
+{
+  struct json_value *result;
+
+  if (p->token == json_number_token && p->state != json_error)
+    {
+      if (json_parser_end_number (p))
+        p->state = json_error;
+    }
+
+  if (p->state != json_done)
+    {
+      json_parser_reset (p);
+      return 0;
+    }
+
+  result = p->root;
+  p->root = 0;
+
+  json_parser_reset (p);
+
+  return result;
+}
+
+static int
+json_print_string (const char *string)
+{
+  putchar ('"');
+
+  while (*string)
+    {
+      switch (*string)
+        {
+        case '\b': putchar ('\\'); putchar ('b'); break;
+        case '\f': putchar ('\\'); putchar ('f'); break;
+        case '\n': putchar ('\\'); putchar ('n'); break;
+        case '\r': putchar ('\\'); putchar ('r'); break;
+        case '\t': putchar ('\\'); putchar ('t'); break;
+        case '"':  putchar ('\\'); putchar ('"'); break;
+        case '\\': putchar ('\\'); putchar ('\\'); break;
+
+        default:
+
+          if (iscntrl (*string))
+            printf ("\\x%x", *string);
+          else
+            putchar (*string);
+
+          break;
+        }
+
+      ++string;
+    }
+
+  putchar ('"');
+
+  return 0;
+}
+
+int
+json_print (const struct json_value *v)
+{
+  const struct json_node *n;
+
+  if (!v)
+    return printf ("<null>");
+
+  switch (v->type)
+    {
+    case json_number:
+
+      return printf ("%g", v->v.number);
+
+    case json_string:
+
+      return json_print_string (v->v.string);
+
+    case json_boolean:
+
+      return printf (v->v.boolean ? "true" : "false");
+
+    case json_array:
+
+      putchar ('[');
+
+      for (v = v->v.array; v; v = v->next)
+        {
+          if (-1 == json_print (v))
+            return -1;
+
+          if (v->next)
+            putchar (',');
+        }
+
+      putchar (']');
+
+      return 0;
+
+    case json_object:
+
+      putchar ('{');
+
+      for (n = v->v.object; n; n = n->next)
+        {
+          if (-1 == json_print_string (n->name))
+            return -1;
+
+          putchar (':');
+
+          if (-1 == json_print (n->value))
+            return -1;
+
+          if (n->next)
+            putchar (',');
+        }
+
+      putchar ('}');
+
+      return 0;
+
+    default:
+
+      return printf ("null");
+    }
+}
+
+/* Buffered encoding.  */
+
+static int
+json_buffer_reserve (struct json_buffer *b, size_t size)
+{
+  size_t capacity;
+  char *grown;
+
+  /* One byte more, so that the text can always be terminated.  */
+  if (b->size + size < b->capacity)
+    return 0;
+
+  capacity = b->capacity ? b->capacity : 256;
+  while (capacity <= b->size + size)
+    capacity *= 2;
+
+  if (!(grown = realloc (b->data, capacity)))
+    return -1;
+
+  b->data = grown;
+  b->capacity = capacity;
+
+  return 0;
+}
+
+void
+json_buffer_free (struct json_buffer *b)
+{
+  free (b->data);
+  b->data = 0;
+  b->size = b->capacity = 0;
+}
+
+int
+json_encode_raw (struct json_buffer *b, const char *data, size_t size)
+{
+  if (-1 == json_buffer_reserve (b, size))
+    return -1;
+
+  memcpy (b->data + b->size, data, size);
+  b->size += size;
+  b->data[b->size] = 0;
+
+  return 0;
+}
+
+/* What a byte turns into inside a string: 0 if it is copied as it is, or
+ * the letter of its escape sequence.  */
+static const char json_escapes[256] =
+{
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+  ['"'] = '"', ['\\'] = '\\', [0x7f] = 'u'
+};
+
+int
+json_encode_string (struct json_buffer *b, const char *string)
+{
+  static const char hex[] = "0123456789abcdef";
+  const unsigned char *c = (const unsigned char *) string, *run;
+  size_t length = strlen (string);
+  char *o;
+
+  /* Every byte takes at most six, and the quotes two.  */
+  if (-1 == json_buffer_reserve (b, length * 6 + 2))
+    return -1;
+
+  o = b->data + b->size;
+  *o++ = '"';
+
+  for (;;)
+    {
+      for (run = c; !json_escapes[*c]; ++c)
+        ;
+
+      memcpy (o, run, c - run);
+      o += c - run;
+
+      /* The terminating NUL is escaped as well, and ends the string.  */
+      if (!*c)
+        break;
+
+      *o++ = '\\';
+      *o++ = json_escapes[*c];
+      if (json_escapes[*c] == 'u')
+        {
+          *o++ = '0';
+          *o++ = '0';
+          *o++ = hex[*c >> 4];
+          *o++ = hex[*c & 15];
+        }
+
+      ++c;
+    }
+
+  *o++ = '"';
+  *o = 0;
+  b->size = o - b->data;
+
+  return 0;
+}
+
+int
+json_encode_integer (struct json_buffer *b, long long number)
+{
+  char digits[24], *o = digits + sizeof (digits);
+  unsigned long long n = number < 0 ? -(unsigned long long) number : (unsigned long long) number;
+
+  do
+    *--o = '0' + n % 10;
+  while (n /= 10);
+
+  if (number < 0)
+    *--o = '-';
+
+  return json_encode_raw (b, o, digits + sizeof (digits) - o);
+}
+
+int
+json_encode_number (struct json_buffer *b, double number)
+{
+  char text[32];
+  int length;
+
+  /* Times, counts and most other numbers are integers, and skip
+   * printf.  */
+  if (number >= -1e15 && number <= 1e15 && number == (double) (long long) number)
+    return json_encode_integer (b, (long long) number);
+
+  /* JSON has no infinities or NaNs.  */
+  if (number != number || number - number != 0)
+    return json_encode_raw (b, "null", 4);
+
+  /* The shortest of the two that reads back as the same double.  */
+  length = snprintf (text, sizeof (text), "%.15g", number);
+  if (strtod (text, 0) != number)
+    length = snprintf (text, sizeof (text), "%.17g", number);
+
+  return json_encode_raw (b, text, length);
+}
+
+int
+json_encode (struct json_buffer *b, const struct json_value *v)
+{
+  const struct json_node *n;
+
+  if (!v)
+    return json_encode_raw (b, "null", 4);
+
+  switch (v->type)
+    {
+    case json_number:
+
+      return json_encode_number (b, v->v.number);
+
+    case json_string:
+
+      return json_encode_string (b, v->v.string);
+
+    case json_boolean:
+
+      return v->v.boolean ? json_encode_raw (b, "true", 4) : json_encode_raw (b, "false", 5);
+
+    case json_array:
+
+      if (-1 == json_encode_raw (b, "[", 1))
+        return -1;
+
+      for (v = v->v.array; v; v = v->next)
+        {
+          if (-1 == json_encode (b, v)
+              || (v->next && -1 == json_encode_raw (b, ",", 1)))
+            return -1;
+        }
+
+      return json_encode_raw (b, "]", 1);
+
+    case json_object:
+
+      if (-1 == json_encode_raw (b, "{", 1))
+        return -1;
+
+      for (n = v->v.object; n; n = n->next)
+        {
+          if (-1 == json_encode_string (b, n->name)
+              || -1 == json_encode_raw (b, ":", 1)
+              || -1 == json_encode (b, n->value)
+              || (n->next && -1 == json_encode_raw (b, ",", 1)))
+            return -1;
+        }
+
+      return json_encode_raw (b, "}", 1);
+
+    default:
+
+      return json_encode_raw (b, "null", 4);
+    }
+}
+
+/* Schema-directed decoding.  */
+
+static uint32_t
+json_key_hash (const char *key, size_t length, uint32_t seed)
+{
+  uint32_t h = seed;
+  size_t i;
+
+  for (i = 0; i < length; ++i)
+    h = (h ^ (unsigned char) key[i]) * 16777619u;
+
+  return h ^ (h >> 15);
+}
+
+/* Tries table sizes from the smallest power of two that holds every
+ * field upwards, and for each size a range of seeds, until no two names
+ * share a slot.  */
+int
+json_schema_compile (struct json_schema *schema)
+{
+  unsigned int size, seed;
+  size_t i;
+
+  if (schema->nfields >= JSON_SCHEMA_SLOTS)
+    return -1;
+
+  for (i = 0; i < schema->nfields; ++i)
+    if (schema->fields[i].schema
+        && schema->fields[i].schema != schema
+        && json_schema_compile (schema->fields[i].schema) == -1)
+      return -1;
+
+  for (size = 1; size < schema->nfields; size <<= 1)
+    ;
+
+  for (; size <= JSON_SCHEMA_SLOTS; size <<= 1)
+    {
+      for (seed = 1; seed < 0x10000; ++seed)
+        {
+          memset (schema->slots, 0, sizeof (schema->slots));
+
+          for (i = 0; i < schema->nfields; ++i)
+            {
+              const char *name = schema->fields[i].name;
+              uint32_t slot = json_key_hash (name, strlen (name), seed) & (size - 1);
+
+              if (schema->slots[slot])
+                break;
+
+              schema->slots[slot] = i + 1;
+            }
+
+          if (i == schema->nfields)
+            {
+              schema->seed = seed;
+              schema->mask = size - 1;
+
+              return 0;
+            }
+        }
+    }
+
+  return -1;
+}
+
+/* Like json_unescape_into, but writes at most size bytes including the
+ * terminator.  Returns the length of the whole unescaped string, so that
+ * a return value of size or more means the string was truncated, or
+ * (size_t) -1 on a malformed escape.  */
+static size_t
+json_unescape_bounded (char *o, size_t size, const char *c, const char *end)
+{
+  char utf8[6];
+  size_t length = 0, n;
+  unsigned int ch;
+  int full = 0;
+
+  while (c != end)
+    {
+      if (*c == '\\' && c + 1 != end)
+        {
+          ++c;
+          if (JSON_BAD_ESCAPE == (ch = json_escape (&c, end)))
+            return (size_t) -1;
+          n = json_utf8 (utf8, ch);
+        }
+      else
+        {
+          utf8[0] = *c++;
+          n = 1;
+        }
+
+      if (!full && length + n < size)
+        memcpy (o + length, utf8, n);
+      else if (!full)
+        {
+          full = 1;
+          if (size)
+            o[length] = 0;
+        }
+
+      length += n;
+    }
+
+  if (!full && size)
+    o[length] = 0;
+
+  return length;
+}
+
+/* Finds the field of an unescaped name.  */
+static const struct json_field *
+json_schema_find (const struct json_schema *schema, const char *name, size_t length)
+{
+  const struct json_field *field;
+  unsigned int i;
+
+  i = schema->slots[json_key_hash (name, length, schema->seed) & schema->mask];
+  if (!i)
+    return 0;
+
+  field = &schema->fields[i - 1];
+  if (strncmp (field->name, name, length) || field->name[length])
+    return 0;
+
+  return field;
+}
+
+static const struct json_field *
+json_schema_lookup (const struct json_schema *schema, const char *name, const char *end)
+{
+  char unescaped[JSON_SCHEMA_SLOTS];
+  size_t length = end - name;
+
+  if (memchr (name, '\\', length))
+    {
+      length = json_unescape_bounded (unescaped, sizeof (unescaped), name, end);
+      if (length >= sizeof (unescaped))
+        return 0;
+
+      name = unescaped;
+    }
+
+  return json_schema_find (schema, name, length);
+}
+
+/* The binder is a state machine like json_parser, so that a document can
+ * be bound as it arrives, but it keeps no tree: names are looked up as
+ * they end and values are stored as they end.  Only the objects and
+ * arrays the schema binds take a frame; any other value is stepped over,
+ * counting brackets.  */
+#define JSON_BIND_DEPTH 16
+
+enum json_bind_token
+{
+  json_bind_no_token = 0,
+  json_bind_name_token,
+  json_bind_string_token,
+  json_bind_scalar_token,  /* a number, true, false or null */
+  json_bind_skip_token     /* an array or object that is not bound */
+};
+
+struct json_bind_frame
+{
+  /* The field of an array, or null for an object.  */
+  const struct json_field *array;
+  const struct json_schema *schema;
+  void *record;
+  size_t index;
+};
+
+struct json_binder
+{
+  enum json_parser_state state;
+  enum json_bind_token token;
+
+  /* Where the value expected next goes.  A null field skips it.  */
+  const struct json_field *field;
+  void *record;
+
+  /* Partial token carried over from the previous chunk.  Tokens that are
+   * not stored are not kept.  */
+  char *scratch;
+  size_t scratch_size, scratch_alloc;
+  int escape;
+
+  /* Open brackets of the value being skipped, and whether it is inside
+   * one of its strings.  */
+  size_t skip;
+  int quoted;
+
+  struct json_bind_frame stack[JSON_BIND_DEPTH];
+  size_t depth;
+
+  const struct json_field *failed;
+};
+
+struct json_binder *
+json_binder_new (void)
+{
+  return calloc (1, sizeof (struct json_binder));
+}
+
+void
+json_binder_start (struct json_binder *b, const struct json_field *field, void *record)
+{
+  b->state = json_expect_value;
+  b->token = json_bind_no_token;
+  b->field = field;
+  b->record = record;
+  b->scratch_size = 0;
+  b->depth = 0;
+  b->failed = 0;
+}
+
+void
+json_binder_free (struct json_binder *b)
+{
+  if (!b)
+    return;
+
+  free (b->scratch);
+  free (b);
+}
+
+static void
+json_bind_number (const struct json_field *field, char *out, double number)
+{
+  if (field->type == json_field_int)
+    *(int *) out = (int) number;
+  else if (field->type == json_field_size)
+    *(size_t *) out = (size_t) number;
+  else
+    *(double *) out = number;
+}
+
+/* Stores the contents of a string, from start to its closing quote or
+ * terminator at end.  */
+static int
+json_bind_string (struct json_binder *b, const char *start, const char *end)
+{
+  const struct json_field *field = b->field;
+  char *out = (char *) b->record + field->offset;
+  size_t length;
+  double number;
+  char *copy;
+
+  switch (field->type)
+    {
+    case json_field_time:
+
+      json_time (start, end - start, (time_t *) out);
+
+      return 0;
+
+    case json_field_strdup:
+
+      if ((size_t) -1 == (length = json_unescape_bounded (0, 0, start, end))
+          || 0 == (copy = malloc (length + 1)))
+        break;
+
+      json_unescape_into (copy, start, end);
+      free (*(char **) out);
+      *(char **) out = copy;
+
+      return 0;
+
+    case json_field_string:
+    case json_field_text:
+
+      if ((length = json_unescape_bounded (out, field->size, start, end)) == (size_t) -1
+          || (length >= field->size && field->type == json_field_string))
+        break;
+
+      return 0;
+
+    default:
+
+      /* A numeric string; what follows its number is ignored.  */
+      if (isdigit (*start) || *start == '-')
+        {
+          number = strtod (start, &copy);
+          if (copy != start)
+            json_bind_number (field, out, number);
+        }
+
+      return 0;
+    }
+
+  b->failed = field;
+
+  return -1;
+}
+
+/* Stores a number or a boolean that ends at end.  */
+static int
+json_bind_scalar (struct json_binder *b, const char *start, const char *end)
+{
+  const struct json_field *field = b->field;
+  char *out = (char *) b->record + field->offset;
+  double number;
+  char *stop;
+
+  if (field->type == json_field_boolean)
+    {
+      if (end - start == 4 && !memcmp (start, "true", 4))
+        *(int *) out = 1;
+      else if (end - start == 5 && !memcmp (start, "false", 5))
+        *(int *) out = 0;
+
+      return 0;
+    }
+
+  number = strtod (start, &stop);
+  if (stop != end)
+    return -1;
+
+  json_bind_number (field, out, number);
+
+  return 0;
+}
+
+static void
+json_binder_end_value (struct json_binder *b)
+{
+  b->token = json_bind_no_token;
+  b->scratch_size = 0;
+  b->state = b->depth ? json_expect_comma_or_close : json_done;
+}
+
+static int
+json_binder_push (struct json_binder *b, const struct json_field *array,
+                  const struct json_schema *schema, void *record)
+{
+  struct json_bind_frame *frame;
+
+  if (b->depth == JSON_BIND_DEPTH)
+    return -1;
+
+  frame = &b->stack[b->depth++];
+  frame->array = array;
+  frame->schema = schema;
+  frame->record = record;
+  frame->index = 0;
+
+  b->state = array ? json_expect_value_or_close : json_expect_name_or_close;
+
+  return 0;
+}
+
+static int
+json_binder_close (struct json_binder *b, char ch)
+{
+  if (!b->depth || (ch == ']') != (b->stack[b->depth - 1].array != 0))
+    return -1;
+
+  --b->depth;
+  b->state = b->depth ? json_expect_comma_or_close : json_done;
+
+  return 0;
+}
+
+/* Starts the value that begins with ch, to be stored in b->field of
+ * b->record.  A value of another type than the field's is skipped.  */
+static int
+json_binder_begin_value (struct json_binder *b, char ch)
+{
+  const struct json_field *field = b->field;
+  int bound = 0;
+
+  if (field)
+    {
+      switch (field->type)
+        {
+        case json_field_string:
+        case json_field_text:
+        case json_field_strdup:
+        case json_field_time:
+
+          bound = ch == '"';
+          break;
+
+        case json_field_int:
+        case json_field_size:
+        case json_field_double:
+
+          bound = ch == '"' || isdigit (ch) || ch == '-';
+          break;
+
+        case json_field_boolean:
+
+          bound = ch == 't' || ch == 'f';
+          break;
+
+        case json_field_object:
+
+          if (ch == '{')
+            return json_binder_push (b, 0, field->schema, (char *) b->record + field->offset);
+          break;
+
+        case json_field_array:
+
+          if (ch == '[')
+            return json_binder_push (b, field, field->schema, b->record);
+          break;
+        }
+    }
+
+  if (!bound)
+    b->field = 0;
+
+  if (ch == '{' || ch == '[')
+    {
+      b->token = json_bind_skip_token;
+      b->skip = 1;
+      b->quoted = 0;
+    }
+  else if (ch == '"')
+    {
+      b->token = json_bind_string_token;
+      b->escape = 0;
+    }
+  else if (ch == ']' || ch == '}' || ch == ',' || ch == ':')
+    return -1;
+  else
+    b->token = json_bind_scalar_token;
+
+  return 0;
+}
+
+/* Starts an element of the innermost array, which is bound if it is an
+ * object that the array's element function has a place for.  */
+static int
+json_binder_begin_element (struct json_binder *b, char ch)
+{
+  struct json_bind_frame *frame = &b->stack[b->depth - 1];
+  void *element;
+
+  if (ch == '{' && (element = frame->array->element (frame->record, frame->index++)))
+    return json_binder_push (b, 0, frame->schema, element);
+
+  b->field = 0;
+
+  return json_binder_begin_value (b, ch);
+}
+
+/* Ends the string or name token in progress, whose contents end at c in
+ * the chunk that started at data.  */
+static int
+json_binder_end_string (struct json_binder *b, const char *data, const char *c)
+{
+  struct json_bind_frame *frame;
+
+  if (b->scratch_size)
+    {
+      if (json_save (&b->scratch, &b->scratch_size, &b->scratch_alloc, data, c - data))
+        return -1;
+
+      data = b->scratch;
+      c = b->scratch + b->scratch_size;
+    }
+
+  if (b->token == json_bind_name_token)
+    {
+      frame = &b->stack[b->depth - 1];
+      b->field = json_schema_lookup (frame->schema, data, c);
+      b->record = frame->record;
+      b->token = json_bind_no_token;
+      b->scratch_size = 0;
+      b->state = json_expect_colon;
+
+      return 0;
+    }
+
+  if (b->field && json_bind_string (b, data, c))
+    return -1;
+
+  json_binder_end_value (b);
+
+  return 0;
+}
+
+static int
+json_binder_end_scalar (struct json_binder *b, const char *data, const char *c)
+{
+  if (b->field)
+    {
+      if (b->scratch_size)
+        {
+          if (json_save (&b->scratch, &b->scratch_size, &b->scratch_alloc, data, c - data))
+            return -1;
+
+          data = b->scratch;
+          c = b->scratch + b->scratch_size;
+        }
+
+      if (json_bind_scalar (b, data, c))
+        return -1;
+    }
+
+  json_binder_end_value (b);
+
+  return 0;
+}
+
+/* Continues the token in progress.  Returns the number of bytes consumed,
+ * or -1 on error.  */
+static long
+json_binder_token (struct json_binder *b, const char *data, const char *end)
+{
+  const char *c = data;
+
+  switch (b->token)
+    {
+    case json_bind_name_token:
+    case json_bind_string_token:
+
+      for (; c != end; ++c)
+        {
+          if (b->escape)
+            b->escape = 0;
+          else if (*c == '\\')
+            b->escape = 1;
+          else if (*c == '"')
+            return json_binder_end_string (b, data, c) ? -1 : c + 1 - data;
+        }
+
+      break;
+
+    case json_bind_scalar_token:
+
+      while (c != end && *c != ',' && *c != ']' && *c != '}' && !isspace (*c))
+        ++c;
+
+      if (c != end)
+        return json_binder_end_scalar (b, data, c) ? -1 : c - data;
+
+      break;
+
+    case json_bind_skip_token:
+
+      for (; c != end; ++c)
+        {
+          if (b->quoted)
+            {
+              if (b->escape)
+                b->escape = 0;
+              else if (*c == '\\')
+                b->escape = 1;
+              else if (*c == '"')
+                b->quoted = 0;
+            }
+          else if (*c == '"')
+            b->quoted = 1;
+          else if (*c == '[' || *c == '{')
+            ++b->skip;
+          else if ((*c == ']' || *c == '}') && !--b->skip)
+            {
+              json_binder_end_value (b);
+              return c + 1 - data;
+            }
+        }
+
+      return c - data;
 
     default:
 
-      return printf ("null");
+      return -1;
+    }
+
+  /* The token goes on in the next chunk.  */
+  if ((b->token == json_bind_name_token || b->field)
+      && json_save (&b->scratch, &b->scratch_size, &b->scratch_alloc, data, c - data))
+    return -1;
+
+  return c - data;
+}
+
+/* Binds from data up to end, and returns where it stopped: at end, after
+ * the document, or at the error.  */
+static const char *
+json_binder_run (struct json_binder *b, const char *data, const char *end)
+{
+  const char *c = data;
+
+  while (c != end && b->state != json_done && b->state != json_error)
+    {
+      long n;
+
+      if (b->token)
+        {
+          if (-1 == (n = json_binder_token (b, c, end)))
+            b->state = json_error;
+          else
+            c += n;
+
+          continue;
+        }
+
+      if (isspace (*c))
+        {
+          ++c;
+          continue;
+        }
+
+      switch (b->state)
+        {
+        case json_expect_value_or_close:
+
+          if (*c == ']')
+            {
+              if (json_binder_close (b, *c))
+                b->state = json_error;
+            }
+          else if (json_binder_begin_element (b, *c))
+            b->state = json_error;
+
+          break;
+
+        case json_expect_value:
+
+          if (json_binder_begin_value (b, *c))
+            b->state = json_error;
+
+          break;
+
+        case json_expect_name_or_close:
+
+          if (*c == '}')
+            {
+              if (json_binder_close (b, *c))
+                b->state = json_error;
+            }
+          else if (*c == '"')
+            {
+              b->token = json_bind_name_token;
+              b->escape = 0;
+            }
+          else
+            b->state = json_error;
+
+          break;
+
+        case json_expect_colon:
+
+          b->state = (*c == ':') ? json_expect_value : json_error;
+
+          break;
+
+        case json_expect_comma_or_close:
+
+          /* A trailing comma is accepted, as json_decode accepts it.  */
+          if (*c == ',')
+            b->state = b->stack[b->depth - 1].array
+                       ? json_expect_value_or_close : json_expect_name_or_close;
+          else if (json_binder_close (b, *c))
+            b->state = json_error;
+
+          break;
+
+        default:
+
+          b->state = json_error;
+        }
+
+      /* A scalar starts with its first byte.  */
+      if (b->token != json_bind_scalar_token)
+        ++c;
     }
+
+  return c;
+}
+
+int
+json_binder_feed (struct json_binder *b, const char *data, size_t size)
+{
+  json_binder_run (b, data, data + size);
+
+  return (b->state == json_error) ? -1 : 0;
+}
+
+int
+json_binder_finish (struct json_binder *b, const struct json_field **failed)
+{
+  const struct json_field *ignored;
+  int result;
+
+  if (!failed)
+    failed = &ignored;
+
+  /* A number that is the whole document ends with it.  */
+  if (b->token == json_bind_scalar_token && b->state != json_error
+      && json_binder_end_scalar (b, b->scratch, b->scratch))
+    b->state = json_error;
+
+  result = (b->state == json_done) ? 0 : -1;
+  *failed = result ? b->failed : 0;
+
+  b->state = json_error;
+  b->token = json_bind_no_token;
+  b->scratch_size = 0;
+  b->depth = 0;
+
+  return result;
+}
+
+const char *
+json_bind (const char *input, const struct json_field *field, void *record,
+           const struct json_field **failed)
+{
+  struct json_binder b;
+  const char *c;
+
+  memset (&b, 0, sizeof (b));
+  json_binder_start (&b, field, record);
+
+  c = json_binder_run (&b, input, input + strlen (input));
+  if (json_binder_finish (&b, failed))
+    c = 0;
+
+  free (b.scratch);
+
+  return c;
+}
+
+/* Reads exactly n digits.  */
+static int
+json_digits (const char **c, const char *end, int n, int *value)
+{
+  *value = 0;
+
+  for (; n; --n, ++*c)
+    {
+      if (*c == end || !isdigit (**c))
+        return -1;
+
+      *value = *value * 10 + (**c - '0');
+    }
+
+  return 0;
+}
+
+/* Days from 1970-01-01 to the given date of the proleptic Gregorian
+ * calendar.  */
+static long
+json_days (int year, int month, int day)
+{
+  long era, yoe, doy, doe;
+
+  year -= month <= 2;
+  era = (year >= 0 ? year : year - 399) / 400;
+  yoe = year - era * 400;
+  doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+  return era * 146097 + doe - 719468;
+}
+
+int
+json_time (const char *string, size_t length, time_t *t)
+{
+  const char *c = string, *end = string + length;
+  int year, month, day, hour, minute, second, zone = 0;
+
+  /* The slashes of "\/Date(...)\/" may still be escaped.  */
+  if (c != end && *c == '\\')
+    ++c;
+
+  if (c != end && *c == '/')
+    {
+      long long ms = 0;
+      int negative;
+
+      ++c;
+      if (end - c < 5 || memcmp (c, "Date(", 5))
+        return -1;
+      c += 5;
+
+      if ((negative = (c != end && *c == '-')))
+        ++c;
+
+      if (c == end || !isdigit (*c))
+        return -1;
+
+      while (c != end && isdigit (*c))
+        ms = ms * 10 + (*c++ - '0');
+
+      /* The milliseconds are UTC already; the zone only says where the
+       * time was written.  */
+      if (c != end && (*c == '+' || *c == '-'))
+        for (++c; c != end && isdigit (*c); ++c)
+          ;
+
+      if (c == end || *c != ')')
+        return -1;
+
+      *t = (negative ? -ms : ms) / 1000;
+
+      return 0;
+    }
+
+  if (json_digits (&c, end, 4, &year) || c == end || *c++ != '-'
+      || json_digits (&c, end, 2, &month) || c == end || *c++ != '-'
+      || json_digits (&c, end, 2, &day) || c == end || (*c != 'T' && *c != ' ')
+      || (++c, json_digits (&c, end, 2, &hour)) || c == end || *c++ != ':'
+      || json_digits (&c, end, 2, &minute) || c == end || *c++ != ':'
+      || json_digits (&c, end, 2, &second))
+    return -1;
+
+  if (month < 1 || month > 12 || day < 1 || day > 31)
+    return -1;
+
+  if (c != end && (*c == '.' || *c == ','))
+    for (++c; c != end && isdigit (*c); ++c)
+      ;
+
+  if (c != end && (*c == '+' || *c == '-'))
+    {
+      int sign = *c++ == '-' ? -1 : 1, zh, zm = 0;
+
+      if (json_digits (&c, end, 2, &zh))
+        return -1;
+      if (c != end && *c == ':')
+        ++c;
+      if (c != end && json_digits (&c, end, 2, &zm))
+        return -1;
+
+      zone = sign * (zh * 3600 + zm * 60);
+    }
+  else if (c != end && *c == 'Z')
+    ++c;
+
+  if (c != end)
+    return -1;
+
+  *t = (time_t) json_days (year, month, day) * 86400 + hour * 3600 + minute * 60 + second - zone;
+
+  return 0;
 }
 
 #ifdef TEST
+struct test_config
+{
+  char *font;
+  int size, odin;
+  struct test_station { char id[8]; int mintime; } stations[4];
+  size_t nstations;
+};
+
+static void *
+test_station (void *record, size_t index)
+{
+  struct test_config *c = record;
+
+  if (index >= sizeof (c->stations) / sizeof (c->stations[0]))
+    return 0;
+
+  c->nstations = index + 1;
+
+  return &c->stations[index];
+}
+
+/* Whether two trees are the same, for checking json_decode_indexed
+ * against json_decode.  */
+static int
+test_same (const struct json_value *a, const struct json_value *b)
+{
+  const struct json_node *m, *n;
+
+  if (!a || !b)
+    return a == b;
+
+  if (a->type != b->type)
+    return 0;
+
+  switch (a->type)
+    {
+    case json_number:
+
+      return a->v.number == b->v.number;
+
+    case json_string:
+
+      return !strcmp (a->v.string, b->v.string);
+
+    case json_boolean:
+
+      return a->v.boolean == b->v.boolean;
+
+    case json_array:
+
+      for (a = a->v.array, b = b->v.array; a && b; a = a->next, b = b->next)
+        if (!test_same (a, b))
+          return 0;
+
+      return a == b;
+
+    case json_object:
+
+      for (m = a->v.object, n = b->v.object; m && n; m = m->next, n = n->next)
+        if (strcmp (m->name, n->name) || !test_same (m->value, n->value))
+          return 0;
+
+      return m == n;
+
+    default:
+
+      return 1;
+    }
+}
+
+/* Decodes input with json_decode_indexed, with and without an arena,
+ * and fails unless both give what json_decode gives.  */
+static int
+test_indexed (const char *input)
+{
+  struct json_arena *arena = json_arena_new (0);
+  size_t length = strlen (input);
+  char *copy = malloc (length + 1);
+  struct json_value *expected, *j;
+  int same;
+
+  memcpy (copy, input, length + 1);
+
+  expected = json_decode (input);
+  j = json_decode_indexed (copy, length, 0);
+  same = test_same (expected, j);
+  json_free (j);
+
+  same = same && test_same (expected, json_decode_indexed (copy, length, arena));
+
+  json_free (expected);
+  json_arena_free (arena);
+  free (copy);
+
+  return same;
+}
+
 int
 main (int argc, char **argv)
 {
@@ -442,5 +2778,216 @@ main (int argc, char **argv)
 
   j = json_decode ("{\"error\":{\"code\":-257,\"result\":null,\"message\":\"Hash is too large: want=0000000001beb000000000000000000000000000000000000000000000000000 has=0bb15d2115e38086e3b6c568c861ee45eaa733fa5ee94ace6f6105267518d8d7\n\"},\"id\":1}");
   json_print (j);
+  printf ("\n");
+  json_free (j);
+
+  {
+    struct json_buffer b = { 0, 0, 0 };
+    struct json_value *round;
+
+    j = json_decode ("{\"s\":\"a\\\"b\\\\c\\n\\u0001\xc3\xa6\",\"n\":[0,-42,1350475500,0.1,-2.5e-300,1e300],"
+                     "\"t\":true,\"f\":false,\"z\":null}");
+    if (-1 == json_encode (&b, j)
+        || strcmp (b.data, "{\"s\":\"a\\\"b\\\\c\\n\\u0001\xc3\xa6\",\"n\":[0,-42,1350475500,0.1,-2.5e-300,1e+300],"
+                   "\"t\":true,\"f\":false,\"z\":null}"))
+      printf ("json_encode failed: %s\n", b.data);
+
+    /* What json_encode writes decodes to the same tree.  */
+    round = json_decode (b.data);
+    b.size = 0;
+    if (!round || -1 == json_encode (&b, round) || strlen (b.data) != b.size)
+      printf ("json_encode round trip failed\n");
+
+    json_free (round);
+    json_free (j);
+    json_buffer_free (&b);
+  }
+
+  {
+    struct test_record { char line[4]; int direction; time_t arrival; } r;
+    static const struct json_field fields[] = {
+      JSON_FIELD (struct test_record, line, json_field_text, "LineRef"),
+      JSON_FIELD (struct test_record, direction, json_field_int, "DirectionRef"),
+      JSON_FIELD (struct test_record, arrival, json_field_time, "ExpectedArrivalTime"),
+    };
+    static struct json_schema schema = { .fields = fields, .nfields = 3 };
+    const struct json_field object = { 0, json_field_object, 0, 0, &schema, 0 };
+    const struct json_field *failed;
+    struct json_binder *b;
+    size_t i;
+    time_t t;
+
+    static const char split[] = "{\"LineRef\":\"1\",\"DirectionRef\":";
+    static const char input[] = "{\"Skip\":[{\"a\":\"]\"}],\"LineRef\":\"12345\",\"DirectionRef\":\"2\","
+                                "\"ExpectedArrivalTime\":\"\\/Date(1350475500000+0200)\\/\"}";
+
+    memset (&r, 0, sizeof (r));
+    if (json_schema_compile (&schema) == -1
+        || !json_bind (input, &object, &r, 0)
+        || strcmp (r.line, "123") || r.direction != 2 || r.arrival != 1350475500)
+      printf ("json_bind failed\n");
+
+    /* Fed a byte at a time, the binder stores the same.  */
+    memset (&r, 0, sizeof (r));
+    b = json_binder_new ();
+    json_binder_start (b, &object, &r);
+    for (i = 0; i < sizeof (input) - 1; ++i)
+      json_binder_feed (b, input + i, 1);
+    if (json_binder_finish (b, &failed)
+        || strcmp (r.line, "123") || r.direction != 2 || r.arrival != 1350475500)
+      printf ("json_binder failed\n");
+
+    /* A document cut short is malformed; a number split between chunks
+     * is put back together, and what follows the document is ignored.  */
+    json_binder_start (b, &object, &r);
+    json_binder_feed (b, input, sizeof (input) - 2);
+    if (!json_binder_finish (b, &failed) || failed)
+      printf ("json_binder accepted a truncated document\n");
+    json_binder_start (b, &object, &r);
+    json_binder_feed (b, split, strlen (split));
+    json_binder_feed (b, "2.5}  trailing", strlen ("2.5}  trailing"));
+    if (json_binder_finish (b, &failed) || r.direction != 2)
+      printf ("json_binder failed on a split number\n");
+    json_binder_free (b);
+
+    if (json_time ("2012-10-17T14:05:00+02:00", 25, &t) || t != 1350475500
+        || json_time ("2012-10-17 12:05:00Z", 20, &t) || t != 1350475500)
+      printf ("json_time failed\n");
+  }
+
+  {
+    /* Shaped like vestli.conf, trailing commas and all.  */
+    static const char input[] =
+      "{\n"
+      "    \"FontPath\": \"/usr/share/fonts/DejaVuSans-Bold.ttf\",\n"
+      "    \"RowFontSize\": 56,\n"
+      "    \"Stations\": [\n"
+      "        { \"ID\": \"3010370\", \"MinTime\": 180, \"Name\": \"Forskningsparken\" },\n"
+      "        { \"ID\": \"3012323\", \"MinTime\": 45, },\n"
+      "    ],\n"
+      "    \"OdinMode\": true,\n"
+      "}\n";
+    static const struct json_field station_fields[] = {
+      JSON_FIELD (struct test_station, id, json_field_string, "ID"),
+      JSON_FIELD (struct test_station, mintime, json_field_int, "MinTime"),
+    };
+    static struct json_schema station_schema = { .fields = station_fields, .nfields = 2 };
+    static const struct json_field fields[] = {
+      JSON_FIELD (struct test_config, font, json_field_strdup, "FontPath"),
+      JSON_FIELD (struct test_config, size, json_field_int, "RowFontSize"),
+      JSON_FIELD (struct test_config, odin, json_field_boolean, "OdinMode"),
+      { "Stations", json_field_array, 0, 0, &station_schema, test_station },
+    };
+    static struct json_schema schema = { .fields = fields, .nfields = 4 };
+    const struct json_field object = { 0, json_field_object, 0, 0, &schema, 0 };
+    const struct json_field *failed;
+    struct test_config c;
+
+    memset (&c, 0, sizeof (c));
+    if (json_schema_compile (&schema) == -1
+        || !json_bind (input, &object, &c, 0)
+        || !c.font || strcmp (c.font, "/usr/share/fonts/DejaVuSans-Bold.ttf") || c.size != 56 || !c.odin
+        || c.nstations != 2 || strcmp (c.stations[1].id, "3012323") || c.stations[1].mintime != 45)
+      printf ("json_bind failed on trailing commas\n");
+
+    /* An ID too long for its field fails the bind, naming the field.  */
+    if (json_bind ("{\"Stations\":[{\"ID\":\"301037012\"}]}", &object, &c, &failed)
+        || failed != &station_fields[0])
+      printf ("json_bind stored a string too long for its field\n");
+
+    free (c.font);
+  }
+
+  {
+    /* A \u that is not followed by four hex digits used to go through
+     * strtol, which skipped the space, took the sign and wrote past the
+     * end of the string.  */
+    static const char bad[] = "{\"a\":\"\\u -1\",\"b\":1}";
+    struct json_arena *arena = json_arena_new (0);
+    struct json_parser *p = json_parser_new (0);
+    char copy[sizeof (bad)], text[4] = "";
+    const struct json_field field = { 0, json_field_text, 0, sizeof (text), 0, 0 };
+
+    memcpy (copy, bad, sizeof (bad));
+    if (!(j = json_decode (bad)) || j->v.object)
+      printf ("json_decode accepted a bad \\u\n");
+    json_free (j);
+    if (!(j = json_decode_arena (copy, arena)) || j->v.object
+        || memcmp (copy + sizeof (bad) - 9, "\",\"b\":1}", 8))
+      printf ("json_decode_arena accepted a bad \\u\n");
+    if (-1 != json_parser_feed (p, bad, sizeof (bad) - 1))
+      printf ("json_parser_feed accepted a bad \\u\n");
+    if (json_bind ("\"\\u12\"", &field, text, 0))
+      printf ("json_bind accepted a bad \\u\n");
+
+    j = json_decode ("[\"\\u00e6\\0101\\0\"]");
+    if (!j || strcmp (j->v.array->v.string, "\xc3\xa6" "A"))
+      printf ("json_decode rejected a good escape\n");
+
+    json_free (j);
+    json_parser_free (p);
+    json_arena_free (arena);
+  }
+
+  {
+    /* Every classifier agrees with the scalar one on every byte.  */
+    unsigned char block[64];
+    struct json_masks expected, m;
+    int i, k;
+
+    for (k = 0; k < 4; ++k)
+      {
+        for (i = 0; i < 64; ++i)
+          block[i] = k * 64 + i;
+
+        json_classify_scalar (block, &expected);
+        json_classify (block, &m);
+        if (memcmp (&expected, &m, sizeof (m)))
+          printf ("json_classify (%s) differs from the scalar classifier\n", json_engine ());
+#if JSON_HAVE_X86_SIMD
+        json_classify_sse2 (block, &m);
+        if (memcmp (&expected, &m, sizeof (m)))
+          printf ("json_classify_sse2 differs from the scalar classifier\n");
+#endif
+      }
+  }
+
+  {
+    /* json_decode_indexed gives the trees json_decode gives, with strings
+     * and runs of backslashes on both sides of each 64-byte block
+     * boundary.  */
+    static const char *const documents[] = {
+      "{\"s\":\"a\\\"b\\\\c\\n\\u0001\xc3\xa6\",\"n\":[0,-42,1350475500,0.1,-2.5e-300,1e300,"
+      "123456789012345678,12345678901234567890,-0,1e5],\"t\":true,\"f\":false,\"z\":null}",
+      " [ { \"a\" : [ ] , \"b\" : { } , \"c\" : [ 1 , 2 , ] , } ] ",
+      "[\"\\/Date(1350475500000+0200)\\/\",\"\\\\\",\"\\\\\\\\\\\"\",\"\"]",
+      "\"unterminated",
+      "{\"a\":\"\\u -1\",\"b\":1}",
+    };
+    char input[256];
+    int pad, run;
+    size_t i;
+
+    for (i = 0; i < sizeof (documents) / sizeof (documents[0]); ++i)
+      if (!test_indexed (documents[i]))
+        printf ("json_decode_indexed differs on %s\n", documents[i]);
+
+    for (pad = 0; pad < 70; ++pad)
+      for (run = 0; run < 6; ++run)
+        {
+          /* A run of backslashes, which escapes the quote after it when
+           * it is odd, then another member to tell where the string
+           * ended.  */
+          int n = snprintf (input, sizeof (input), "{\"%*s", pad, "");
+
+          memset (input + n, '\\', run);
+          snprintf (input + n + run, sizeof (input) - n - run, "\"x\":[1,\"%*s\",{}]}", pad % 7, "");
+
+          if (!test_indexed (input))
+            printf ("json_decode_indexed differs on %s\n", input);
+        }
+  }
+
+  return 0;
 }
 #endif
@@ -1,6 +1,9 @@
 #ifndef JSON_H_
 #define JSON_H_
 
+#include <stddef.h>
+#include <time.h>
+
 struct json_node;
 
 enum json_value_type
@@ -40,10 +43,183 @@ struct json_node
 struct json_value *
 json_decode (const char *string);
 
+/* Arena decoding: every value, member and string of the tree is carved out
+ * of the arena, and the whole tree is released at once by json_arena_clear
+ * or json_arena_free instead of json_free.  json_decode_arena unescapes
+ * strings in place, so the input must be writable and outlive the tree.  */
+struct json_arena;
+
+struct json_arena *
+json_arena_new (size_t block_size);
+
+void
+json_arena_clear (struct json_arena *arena);
+
+void
+json_arena_free (struct json_arena *arena);
+
+struct json_value *
+json_decode_arena (char *string, struct json_arena *arena);
+
+/* Second decoder that builds a structural index of the document with
+ * SSE2 or AVX2 when the CPU has them, and a scalar loop otherwise.
+ * Produces the same tree as json_decode.  length is that of string,
+ * which must still be NUL-terminated.  arena may be null; with one,
+ * strings are unescaped in place as by json_decode_arena.  */
+struct json_value *
+json_decode_indexed (char *string, size_t length, struct json_arena *arena);
+
+/* Name of the classifier json_decode_indexed uses on this CPU, which is
+ * chosen once when the program starts.  */
+const char *
+json_engine (void);
+
 void
 json_free (struct json_value *v);
 
+/* Incremental decoder: feed it the document in arbitrary chunks, then call
+ * json_parser_finish to take the decoded value.  The parser is reset by
+ * json_parser_finish and can be reused for the next document.  If arena
+ * is not null, the decoded trees are allocated from it.  */
+struct json_parser;
+
+struct json_parser *
+json_parser_new (struct json_arena *arena);
+
+int
+json_parser_feed (struct json_parser *p, const char *data, size_t size);
+
+struct json_value *
+json_parser_finish (struct json_parser *p);
+
+void
+json_parser_free (struct json_parser *p);
+
 int
 json_print (const struct json_value *v);
 
+/* Buffered encoding: json_encode appends v to b as compact JSON, and
+ * keeps the text NUL-terminated.  A buffer starts out all zeroes, and is
+ * reused for the next document by setting size back to 0.  The other
+ * json_encode functions append a single value, for callers that write a
+ * document from their own records without building a tree.  All of them
+ * return -1 if the buffer could not grow.  */
+struct json_buffer
+{
+  char *data;
+  size_t size;
+  size_t capacity;
+};
+
+int
+json_encode (struct json_buffer *b, const struct json_value *v);
+
+int
+json_encode_string (struct json_buffer *b, const char *string);
+
+int
+json_encode_number (struct json_buffer *b, double number);
+
+int
+json_encode_integer (struct json_buffer *b, long long number);
+
+int
+json_encode_raw (struct json_buffer *b, const char *data, size_t size);
+
+void
+json_buffer_free (struct json_buffer *b);
+
+/* Schema-directed decoding: json_bind walks the document once and stores
+ * the members a schema names straight into the caller's structs, without
+ * building a tree.  Members the schema does not name, and values of the
+ * wrong type, are skipped without allocating.  */
+enum json_field_type
+{
+  json_field_string,   /* char[size]; a longer value fails the bind */
+  json_field_text,     /* char[size]; a longer value is truncated */
+  json_field_strdup,   /* char *, malloc'd; the old value is freed */
+  json_field_int,      /* int, from a number or a numeric string */
+  json_field_size,     /* size_t, likewise */
+  json_field_double,   /* double, likewise */
+  json_field_boolean,  /* int */
+  json_field_time,     /* time_t, from a string json_time accepts */
+  json_field_object,   /* struct at offset, bound to schema */
+  json_field_array     /* objects bound to schema, stored where element says */
+};
+
+struct json_schema;
+
+struct json_field
+{
+  const char *name;
+  enum json_field_type type;
+  size_t offset;
+  size_t size;
+  struct json_schema *schema;
+
+  /* For arrays: returns where the index'th object element of the array
+   * goes, given the struct the array is a member of, or null to skip the
+   * element.  */
+  void *(*element) (void *record, size_t index);
+};
+
+#define JSON_FIELD(record, member, type, name) \
+  { (name), (type), offsetof (record, member), sizeof (((record *) 0)->member), 0, 0 }
+
+#define JSON_SCHEMA_SLOTS 64
+
+struct json_schema
+{
+  const struct json_field *fields;
+  size_t nfields;
+
+  /* Perfect hash of the field names, filled in by json_schema_compile.  */
+  unsigned int seed;
+  unsigned int mask;
+  unsigned char slots[JSON_SCHEMA_SLOTS];
+};
+
+/* Finds a perfect hash for the names of schema and of the schemas nested
+ * in it.  Must be called before the schema is used, and returns -1 if
+ * the schema has too many fields.  */
+int
+json_schema_compile (struct json_schema *schema);
+
+/* Binds the value at input, described by field, into record.  Returns a
+ * pointer past the value, or null on malformed input or when a field
+ * could not be stored; *failed, if failed is not null, is then set to
+ * that field, or to null for malformed input.  */
+const char *
+json_bind (const char *input, const struct json_field *field, void *record,
+           const struct json_field **failed);
+
+/* Resumable binding: json_binder_start, then feed the document in
+ * arbitrary chunks, then json_binder_finish, which returns -1 and sets
+ * *failed like json_bind if the document could not be bound.  Values are
+ * stored as soon as they end, so record must stay valid until then.  The
+ * binder can be started again for the next document, and only allocates
+ * to carry a stored token over from one chunk to the next.  */
+struct json_binder;
+
+struct json_binder *
+json_binder_new (void);
+
+void
+json_binder_start (struct json_binder *b, const struct json_field *field, void *record);
+
+int
+json_binder_feed (struct json_binder *b, const char *data, size_t size);
+
+int
+json_binder_finish (struct json_binder *b, const struct json_field **failed);
+
+void
+json_binder_free (struct json_binder *b);
+
+/* Decodes a "/Date(ms+zone)/" timestamp, as .NET serialises them, or an
+ * ISO-8601 one such as "2012-10-17T14:05:00+02:00".  ISO-8601 times
+ * without a zone are taken to be UTC.  Returns -1 if string is neither.  */
+int
+json_time (const char *string, size_t length, time_t *t);
+
 #endif /* !JSON_H_ */
@@ -0,0 +1,287 @@
+#define _POSIX_C_SOURCE 200809L
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "metrics.h"
+
+/* Histogram bucket i counts the observations below 2^(i + METRICS_SHIFT)
+ * nanoseconds, from 16 us up to about a minute, and the last bucket the
+ * rest. Recording an observation is a bit scan and three relaxed atomic
+ * adds, cheap enough to leave on everywhere. */
+#define METRICS_SHIFT 14
+
+struct histogram {
+    unsigned long long buckets[METRICS_BUCKETS];
+    unsigned long long count;
+    unsigned long long sum;
+};
+
+static const struct {
+    const char *name;
+    const char *help;
+} histogram_info[METRICS_HISTOGRAMS] = {
+    [METRICS_HTTP_REQUEST] = { "vestli_http_request_seconds", "Time from the start of a request to its last byte." },
+    [METRICS_JSON_PARSE] = { "vestli_json_parse_seconds", "Time spent decoding one response." },
+    [METRICS_UPDATE] = { "vestli_update_seconds", "Time taken by one update of every station." },
+    [METRICS_FRAME] = { "vestli_frame_seconds", "Time taken by draw() for one frame." },
+};
+
+static const struct {
+    const char *name;
+    const char *help;
+} counter_info[METRICS_COUNTERS] = {
+    [METRICS_MALFORMED_RESPONSES] = { "vestli_responses_malformed_total", "Responses dropped because they were not valid JSON." },
+    [METRICS_TRUNCATED_RESPONSES] = { "vestli_responses_truncated_total", "Responses with more departures than there was room for." },
+    [METRICS_NOT_MODIFIED_RESPONSES] = { "vestli_responses_not_modified_total", "Responses the API answered with 304 Not Modified." },
+    [METRICS_UNCHANGED_RESPONSES] = { "vestli_responses_unchanged_total", "Responses never decoded because they matched the previous one byte for byte." },
+    [METRICS_DEADLINE_MISSES] = { "vestli_frame_deadline_misses_total", "Frames that ran into the next second." },
+    [METRICS_CIRCUITS_OPENED] = { "vestli_station_circuits_opened_total", "Times a station was put on cooldown after failing repeatedly." },
+};
+
+static struct histogram histograms[METRICS_HISTOGRAMS];
+static unsigned long long counters[METRICS_COUNTERS];
+
+static pthread_mutex_t extra_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *extra;
+static size_t extra_capacity;
+
+static int listen_fd = -1;
+
+unsigned long long
+metrics_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void
+metrics_observe(enum metrics_histogram h, unsigned long long ns) {
+    int i = ns ? 64 - __builtin_clzll(ns) - METRICS_SHIFT : 0;
+    if(i < 0)
+        i = 0;
+    else if(i > METRICS_BUCKETS - 1)
+        i = METRICS_BUCKETS - 1;
+
+    __atomic_fetch_add(&histograms[h].buckets[i], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histograms[h].count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histograms[h].sum, ns, __ATOMIC_RELAXED);
+}
+
+void
+metrics_count(enum metrics_counter c, unsigned long long n) {
+    __atomic_fetch_add(&counters[c], n, __ATOMIC_RELAXED);
+}
+
+/* Estimates the q quantile of a histogram in seconds, by interpolating
+ * linearly within the bucket it falls in, as Prometheus does. */
+double
+metrics_quantile(enum metrics_histogram h, double q) {
+    unsigned long long count = __atomic_load_n(&histograms[h].count, __ATOMIC_RELAXED);
+    double rank = q * count;
+    unsigned long long cumulative = 0;
+
+    for(int i = 0; i < METRICS_BUCKETS; ++i) {
+        unsigned long long n = __atomic_load_n(&histograms[h].buckets[i], __ATOMIC_RELAXED);
+        double lower = i ? (double)(1ULL << (i - 1 + METRICS_SHIFT)) : 0;
+
+        if(n && cumulative + n >= rank) {
+            if(i == METRICS_BUCKETS - 1)
+                return lower / 1e9;
+
+            double upper = (double)(1ULL << (i + METRICS_SHIFT));
+            return (lower + (upper - lower) * (rank - cumulative) / n) / 1e9;
+        }
+
+        cumulative += n;
+    }
+
+    return 0;
+}
+
+/* Zeroes every histogram and counter. Not atomic with respect to
+ * observations made meanwhile. */
+void
+metrics_reset(void) {
+    for(int h = 0; h < METRICS_HISTOGRAMS; ++h) {
+        for(int i = 0; i < METRICS_BUCKETS; ++i)
+            __atomic_store_n(&histograms[h].buckets[i], 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&histograms[h].count, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&histograms[h].sum, 0, __ATOMIC_RELAXED);
+    }
+
+    for(int c = 0; c < METRICS_COUNTERS; ++c)
+        __atomic_store_n(&counters[c], 0, __ATOMIC_RELAXED);
+}
+
+/* Replaces the preformatted lines appended to every dump, which is how
+ * the program adds metrics that are not simple counters. The text is
+ * copied into a buffer that is only reallocated when it grows. */
+void
+metrics_set_extra(const char *text) {
+    size_t size = strlen(text) + 1;
+
+    pthread_mutex_lock(&extra_lock);
+    if(size > extra_capacity) {
+        size_t capacity = extra_capacity ? extra_capacity : 4096;
+        while(capacity < size)
+            capacity *= 2;
+
+        char *grown = realloc(extra, capacity);
+        if(grown == NULL) {
+            pthread_mutex_unlock(&extra_lock);
+            return;
+        }
+
+        extra = grown;
+        extra_capacity = capacity;
+    }
+    memcpy(extra, text, size);
+    pthread_mutex_unlock(&extra_lock);
+}
+
+/* Writes every metric in the Prometheus text exposition format. */
+void
+metrics_write(FILE *f) {
+    for(int h = 0; h < METRICS_HISTOGRAMS; ++h) {
+        const char *name = histogram_info[h].name;
+
+        fprintf(f, "# HELP %s %s\n# TYPE %s histogram\n", name, histogram_info[h].help, name);
+
+        unsigned long long cumulative = 0;
+        for(int i = 0; i < METRICS_BUCKETS - 1; ++i) {
+            cumulative += __atomic_load_n(&histograms[h].buckets[i], __ATOMIC_RELAXED);
+            fprintf(f, "%s_bucket{le=\"%g\"} %llu\n", name, (double)(1ULL << (i + METRICS_SHIFT)) / 1e9, cumulative);
+        }
+
+        unsigned long long count = __atomic_load_n(&histograms[h].count, __ATOMIC_RELAXED);
+        fprintf(f, "%s_bucket{le=\"+Inf\"} %llu\n", name, count);
+        fprintf(f, "%s_sum %.9f\n", name, __atomic_load_n(&histograms[h].sum, __ATOMIC_RELAXED) / 1e9);
+        fprintf(f, "%s_count %llu\n", name, count);
+    }
+
+    for(int c = 0; c < METRICS_COUNTERS; ++c) {
+        const char *name = counter_info[c].name;
+
+        fprintf(f, "# HELP %s %s\n# TYPE %s counter\n", name, counter_info[c].help, name);
+        fprintf(f, "%s %llu\n", name, __atomic_load_n(&counters[c], __ATOMIC_RELAXED));
+    }
+
+    pthread_mutex_lock(&extra_lock);
+    if(extra)
+        fputs(extra, f);
+    pthread_mutex_unlock(&extra_lock);
+}
+
+/* Listens on a Unix socket at path, replacing any earlier one, so that
+ * the metrics can be read with e.g. socat. A null path closes it. */
+int
+metrics_listen(const char *path) {
+    if(listen_fd != -1) {
+        close(listen_fd);
+        listen_fd = -1;
+    }
+
+    if(path == NULL)
+        return 0;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd == -1)
+        return -1;
+
+    unlink(path);
+    if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(fd, 4) == -1
+       || fcntl(fd, F_SETFL, O_NONBLOCK) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    listen_fd = fd;
+
+    return 0;
+}
+
+/* Each dump for the socket is written into a buffer through a stream
+ * kept open over it, and both are only made anew, twice as large, when a
+ * dump did not fit. A client thus costs no allocation once the buffer
+ * has grown. */
+static char *dump;
+static size_t dump_capacity;
+static FILE *dump_stream;
+
+/* Writes every metric into the dump buffer, and returns its length, or
+ * -1 if the buffer could not be grown. */
+static long
+metrics_dump(void) {
+    for(;;) {
+        if(dump_stream == NULL) {
+            size_t capacity = dump_capacity ? dump_capacity * 2 : 16384;
+            char *grown = realloc(dump, capacity);
+            if(grown == NULL)
+                return -1;
+
+            dump = grown;
+            dump_capacity = capacity;
+            if((dump_stream = fmemopen(dump, dump_capacity, "w")) == NULL)
+                return -1;
+        }
+
+        rewind(dump_stream);
+        metrics_write(dump_stream);
+        if(fflush(dump_stream) == 0 && !ferror(dump_stream))
+            return ftell(dump_stream);
+
+        fclose(dump_stream);
+        dump_stream = NULL;
+    }
+}
+
+/* Answers every client waiting on the socket with a dump and hangs up.
+ * Never blocks, neither waiting for a client nor writing to one: a client
+ * that does not read gets whatever fits in the socket buffer. Meant to
+ * be called once a frame. */
+void
+metrics_serve(void) {
+    if(listen_fd == -1)
+        return;
+
+    int fd;
+    while((fd = accept(listen_fd, NULL, NULL)) != -1) {
+        long size;
+        if(fcntl(fd, F_SETFL, O_NONBLOCK) == -1 || (size = metrics_dump()) == -1) {
+            close(fd);
+            continue;
+        }
+
+        if(write(fd, dump, size) == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
+            warn("metrics_serve");
+        close(fd);
+    }
+
+    if(errno != EAGAIN && errno != EWOULDBLOCK)
+        warn("metrics_serve");
+}
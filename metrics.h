@@ -0,0 +1,31 @@
+#define METRICS_BUCKETS 24
+
+enum metrics_histogram {
+    METRICS_HTTP_REQUEST,
+    METRICS_JSON_PARSE,
+    METRICS_UPDATE,
+    METRICS_FRAME,
+    METRICS_HISTOGRAMS
+};
+
+enum metrics_counter {
+    METRICS_MALFORMED_RESPONSES,
+    METRICS_TRUNCATED_RESPONSES,
+    METRICS_NOT_MODIFIED_RESPONSES,
+    METRICS_UNCHANGED_RESPONSES,
+    METRICS_DEADLINE_MISSES,
+    METRICS_CIRCUITS_OPENED,
+    METRICS_COUNTERS
+};
+
+unsigned long long metrics_clock(void);
+void metrics_observe(enum metrics_histogram h, unsigned long long ns);
+void metrics_count(enum metrics_counter c, unsigned long long n);
+double metrics_quantile(enum metrics_histogram h, double q);
+void metrics_reset(void);
+
+void metrics_set_extra(const char *text);
+void metrics_write(FILE *f);
+
+int metrics_listen(const char *path);
+void metrics_serve(void);
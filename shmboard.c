@@ -0,0 +1,283 @@
+#define _POSIX_C_SOURCE 200112L
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "strtab.h"
+#include "trafikanten.h"
+#include "shmboard.h"
+
+/* The segment holds one board: a header, a fixed number of station
+ * records, and the departures of those stations one after the other. One
+ * fetcher writes it and any number of renderers read it, guarded by the
+ * sequence number in the header, which is odd while a write is under way.
+ * Readers copy the board out and retry if the sequence number moved, so
+ * neither side ever waits for the other. */
+#define SHMBOARD_MAGIC 0x44425356 /* "VSBD" */
+#define SHMBOARD_VERSION 1
+
+struct shmboard_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seq;
+    uint32_t nstations;
+    uint32_t ndeps;
+    uint32_t reserved[3];
+};
+
+struct shmboard_station {
+    char id[64];
+    int64_t fetched;
+    uint32_t mintime;
+    uint32_t numdeps;
+};
+
+struct shmboard_departure {
+    char line[8];
+    char destination[64];
+    int64_t arrival;
+    int32_t direction;
+    uint32_t reserved;
+};
+
+struct shmboard_segment {
+    struct shmboard_header header;
+    struct shmboard_station stations[SHMBOARD_MAX_STATIONS];
+    struct shmboard_departure deps[SHMBOARD_MAX_DEPARTURES];
+};
+
+struct shmboard {
+    struct shmboard_segment *segment;
+    uint32_t seq;
+
+    /* Where a reader copies the segment before it is known to be whole. */
+    struct shmboard_segment *scratch;
+};
+
+/* shm_open wants a name that starts with a slash. */
+static int
+segment_name(char *buf, size_t size, const char *name) {
+    return snprintf(buf, size, "%s%s", name[0] == '/' ? "" : "/", name) < (int)size ? 0 : -1;
+}
+
+static struct shmboard *
+segment_map(const char *name, int writable) {
+    char path[256];
+    if(segment_name(path, sizeof(path), name) == -1)
+        return NULL;
+
+    int fd = shm_open(path, writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    if(fd == -1)
+        return NULL;
+
+    struct stat st;
+    if((writable && ftruncate(fd, sizeof(struct shmboard_segment)) == -1)
+       || fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(struct shmboard_segment)) {
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, sizeof(struct shmboard_segment), writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        return NULL;
+
+    struct shmboard *board = calloc(1, sizeof(*board));
+    if(board == NULL) {
+        munmap(map, sizeof(struct shmboard_segment));
+        return NULL;
+    }
+
+    board->segment = map;
+
+    return board;
+}
+
+/* Opens the segment called name for writing, creating it if need be. A
+ * segment left by an earlier fetcher is reused, so that renderers that
+ * have it mapped see the boards of the new one. */
+struct shmboard *
+shmboard_create(const char *name) {
+    struct shmboard *board = segment_map(name, 1);
+    if(board == NULL)
+        return NULL;
+
+    struct shmboard_header *header = &board->segment->header;
+    header->magic = SHMBOARD_MAGIC;
+    header->version = SHMBOARD_VERSION;
+
+    return board;
+}
+
+/* Maps the segment called name read-only. Fails if no fetcher has
+ * created it yet. */
+struct shmboard *
+shmboard_open(const char *name) {
+    struct shmboard *board = segment_map(name, 0);
+    if(board == NULL)
+        return NULL;
+
+    const struct shmboard_header *header = &board->segment->header;
+    board->scratch = malloc(sizeof(*board->scratch));
+    if(board->scratch == NULL || header->magic != SHMBOARD_MAGIC || header->version != SHMBOARD_VERSION) {
+        shmboard_close(board);
+        return NULL;
+    }
+
+    return board;
+}
+
+void
+shmboard_close(struct shmboard *board) {
+    if(board == NULL)
+        return;
+
+    munmap(board->segment, sizeof(*board->segment));
+    free(board->scratch);
+    free(board);
+}
+
+/* Writes the departures of every query to the segment. Stations and
+ * departures past the size of the segment are left out. Returns -1 if
+ * any were. */
+int
+shmboard_publish(struct shmboard *board, const struct departure_query *queries, int nqueries) {
+    struct shmboard_segment *s = board->segment;
+    uint32_t ndeps = 0;
+    int ret = 0;
+
+    if(nqueries > SHMBOARD_MAX_STATIONS) {
+        nqueries = SHMBOARD_MAX_STATIONS;
+        ret = -1;
+    }
+
+    /* An odd number left by a fetcher that died while writing is moved
+     * on to the next odd one. */
+    uint32_t seq = (__atomic_load_n(&s->header.seq, __ATOMIC_RELAXED) + 1) | 1;
+    __atomic_store_n(&s->header.seq, seq, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    for(int i = 0; i < nqueries; ++i) {
+        const struct departure_query *q = &queries[i];
+        struct shmboard_station *station = &s->stations[i];
+        uint32_t numdeps = q->numdeps > 0 ? q->numdeps : 0;
+
+        if(numdeps > SHMBOARD_MAX_DEPARTURES - ndeps) {
+            numdeps = SHMBOARD_MAX_DEPARTURES - ndeps;
+            ret = -1;
+        }
+
+        memcpy(station->id, q->station->id, sizeof(station->id));
+        station->fetched = q->fetched;
+        station->mintime = q->station->mintime;
+        station->numdeps = numdeps;
+
+        for(uint32_t j = 0; j < numdeps; ++j) {
+            struct shmboard_departure *d = &s->deps[ndeps++];
+            snprintf(d->line, sizeof(d->line), "%s", strtab_get(q->deps[j].line));
+            snprintf(d->destination, sizeof(d->destination), "%s", strtab_get(q->deps[j].destination));
+            d->arrival = q->deps[j].arrival;
+            d->direction = q->deps[j].direction;
+        }
+    }
+
+    s->header.nstations = nqueries;
+    s->header.ndeps = ndeps;
+
+    __atomic_store_n(&s->header.seq, seq + 1, __ATOMIC_RELEASE);
+
+    return ret;
+}
+
+static void *
+grow(void *ptr, size_t size) {
+    void *grown = realloc(ptr, size ? size : 1);
+    if(grown == NULL)
+        err(1, "cannot allocate shared board");
+
+    return grown;
+}
+
+/* Copies the board out of the segment if it changed since the last call.
+ * Returns 1 if copy was refilled, 0 if there is nothing new or a write
+ * is under way, and -1 if the segment does not hold a valid board. */
+int
+shmboard_read(struct shmboard *board, struct shmboard_copy *copy) {
+    const struct shmboard_segment *s = board->segment;
+    struct shmboard_segment *scratch = board->scratch;
+
+    uint32_t seq = __atomic_load_n(&s->header.seq, __ATOMIC_ACQUIRE);
+    if(seq == board->seq || (seq & 1))
+        return 0;
+
+    scratch->header = s->header;
+    if(scratch->header.nstations > SHMBOARD_MAX_STATIONS || scratch->header.ndeps > SHMBOARD_MAX_DEPARTURES)
+        return -1;
+
+    memcpy(scratch->stations, s->stations, scratch->header.nstations * sizeof(*scratch->stations));
+    memcpy(scratch->deps, s->deps, scratch->header.ndeps * sizeof(*scratch->deps));
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if(__atomic_load_n(&s->header.seq, __ATOMIC_RELAXED) != seq)
+        return 0;
+
+    board->seq = seq;
+
+    int n = scratch->header.nstations;
+    copy->stations = grow(copy->stations, n * sizeof(*copy->stations));
+    copy->queries = grow(copy->queries, n * sizeof(*copy->queries));
+    copy->deps = grow(copy->deps, scratch->header.ndeps * sizeof(*copy->deps));
+    copy->nstations = n;
+
+    uint32_t ndeps = 0;
+    for(int i = 0; i < n; ++i) {
+        const struct shmboard_station *from = &scratch->stations[i];
+        struct station *station = &copy->stations[i];
+        struct departure_query *q = &copy->queries[i];
+
+        if(from->numdeps > scratch->header.ndeps - ndeps)
+            return -1;
+
+        memcpy(station->id, from->id, sizeof(station->id));
+        station->id[sizeof(station->id) - 1] = 0;
+        station->mintime = from->mintime;
+
+        memset(q, 0, sizeof(*q));
+        q->station = station;
+        q->deps = &copy->deps[ndeps];
+        q->maxdeps = from->numdeps;
+        q->numdeps = from->numdeps;
+        q->fetched = from->fetched;
+
+        for(uint32_t j = 0; j < from->numdeps; ++j) {
+            const struct shmboard_departure *d = &scratch->deps[ndeps];
+            departure *dep = &copy->deps[ndeps++];
+            char line[sizeof(d->line) + 1];
+            char destination[sizeof(d->destination) + 1];
+            memcpy(line, d->line, sizeof(d->line));
+            memcpy(destination, d->destination, sizeof(d->destination));
+            line[sizeof(d->line)] = 0;
+            destination[sizeof(d->destination)] = 0;
+
+            dep->line = strtab_intern(line);
+            dep->destination = strtab_intern(destination);
+            dep->arrival = d->arrival;
+            dep->direction = d->direction;
+        }
+    }
+
+    return 1;
+}
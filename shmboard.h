@@ -0,0 +1,19 @@
+#define SHMBOARD_MAX_STATIONS 256
+#define SHMBOARD_MAX_DEPARTURES 16384
+
+struct shmboard;
+
+/* A private copy of the board in a segment. The departures of each query
+ * point into deps, and its station into stations. */
+struct shmboard_copy {
+    struct station *stations;
+    struct departure_query *queries;
+    int nstations;
+    departure *deps;
+};
+
+struct shmboard *shmboard_create(const char *name);
+struct shmboard *shmboard_open(const char *name);
+void shmboard_close(struct shmboard *board);
+int shmboard_publish(struct shmboard *board, const struct departure_query *queries, int nqueries);
+int shmboard_read(struct shmboard *board, struct shmboard_copy *copy);
@@ -0,0 +1,240 @@
+#define _POSIX_C_SOURCE 200112L
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "strtab.h"
+#include "trafikanten.h"
+#include "snapshot.h"
+
+/* The snapshot is a header, one record per station that has been fetched,
+ * and after each station record its departures. All fields have fixed
+ * widths, so the file is read in place from the mapping. */
+#define SNAPSHOT_MAGIC 0x504e5356 /* "VSNP" */
+#define SNAPSHOT_VERSION 1
+
+struct snapshot_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nstations;
+    uint32_t reserved;
+};
+
+struct snapshot_station {
+    char id[64];
+    int64_t fetched;
+    uint32_t numdeps;
+    uint32_t reserved;
+};
+
+struct snapshot_departure {
+    char line[8];
+    char destination[64];
+    int64_t arrival;
+    int32_t direction;
+    uint32_t reserved;
+};
+
+/* Records are gathered here and written a bufferful at a time, so that
+ * saving a snapshot neither allocates nor goes through stdio. Snapshots
+ * are only saved by the fetch thread. */
+static struct {
+    int fd;
+    size_t size;
+    char data[65536];
+} out;
+
+static int
+snapshot_flush(void) {
+    size_t done = 0;
+    while(done < out.size) {
+        ssize_t n = write(out.fd, out.data + done, out.size - done);
+        if(n == -1 && errno != EINTR)
+            return -1;
+        if(n > 0)
+            done += n;
+    }
+
+    out.size = 0;
+
+    return 0;
+}
+
+static int
+snapshot_put(const void *record, size_t size) {
+    if(out.size + size > sizeof(out.data) && snapshot_flush() == -1)
+        return -1;
+
+    memcpy(out.data + out.size, record, size);
+    out.size += size;
+
+    return 0;
+}
+
+/* Writes the departures of every query that has been fetched to a
+ * temporary file, and renames it over path once it is complete, so that
+ * readers only ever see a whole snapshot. */
+int
+snapshot_save(const char *path, const struct departure_query *queries, int nqueries) {
+    char tmp[4096];
+    if(snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+        return -1;
+
+    out.fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if(out.fd == -1)
+        return -1;
+    out.size = 0;
+
+    struct snapshot_header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    for(int i = 0; i < nqueries; ++i)
+        if(queries[i].fetched)
+            ++header.nstations;
+
+    int failed = snapshot_put(&header, sizeof(header));
+
+    for(int i = 0; i < nqueries && !failed; ++i) {
+        const struct departure_query *q = &queries[i];
+        if(!q->fetched)
+            continue;
+
+        struct snapshot_station s;
+        memset(&s, 0, sizeof(s));
+        memcpy(s.id, q->station->id, sizeof(s.id));
+        s.fetched = q->fetched;
+        s.numdeps = q->numdeps;
+        failed = snapshot_put(&s, sizeof(s));
+
+        for(uint32_t j = 0; j < s.numdeps && !failed; ++j) {
+            struct snapshot_departure d;
+            memset(&d, 0, sizeof(d));
+            snprintf(d.line, sizeof(d.line), "%s", strtab_get(q->deps[j].line));
+            snprintf(d.destination, sizeof(d.destination), "%s", strtab_get(q->deps[j].destination));
+            d.arrival = q->deps[j].arrival;
+            d.direction = q->deps[j].direction;
+            failed = snapshot_put(&d, sizeof(d));
+        }
+    }
+
+    if(failed || snapshot_flush() == -1 || fsync(out.fd) == -1) {
+        int saved = errno;
+        close(out.fd);
+        unlink(tmp);
+        errno = saved;
+        return -1;
+    }
+
+    if(close(out.fd) == -1 || rename(tmp, path) == -1) {
+        int saved = errno;
+        unlink(tmp);
+        errno = saved;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Fills the queries of the stations found in the snapshot that were
+ * fetched less than max_age seconds ago. Returns the number of stations
+ * restored, or -1 if there is no usable snapshot. */
+int
+snapshot_load(const char *path, struct departure_query *queries, int nqueries, time_t max_age) {
+    int fd = open(path, O_RDONLY);
+    if(fd == -1)
+        return -1;
+
+    struct stat st;
+    if(fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(struct snapshot_header)) {
+        close(fd);
+        return -1;
+    }
+
+    size_t size = st.st_size;
+    const char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        return -1;
+
+    const struct snapshot_header *header = (const struct snapshot_header *)map;
+    if(header->magic != SNAPSHOT_MAGIC || header->version != SNAPSHOT_VERSION) {
+        munmap((void *)map, size);
+        return -1;
+    }
+
+    time_t now = time(NULL);
+    size_t offset = sizeof(*header);
+    int restored = 0;
+
+    for(uint32_t k = 0; k < header->nstations; ++k) {
+        if(size - offset < sizeof(struct snapshot_station))
+            break;
+
+        const struct snapshot_station *s = (const struct snapshot_station *)(map + offset);
+        offset += sizeof(*s);
+
+        if((size - offset) / sizeof(struct snapshot_departure) < s->numdeps)
+            break;
+
+        const struct snapshot_departure *d = (const struct snapshot_departure *)(map + offset);
+        offset += s->numdeps * sizeof(*d);
+
+        if(s->fetched < now - max_age || memchr(s->id, 0, sizeof(s->id)) == NULL)
+            continue;
+
+        struct departure_query *q = NULL;
+        for(int i = 0; i < nqueries && q == NULL; ++i)
+            if(!strcmp(queries[i].station->id, s->id))
+                q = &queries[i];
+
+        if(q == NULL)
+            continue;
+
+        if(q->maxdeps < s->numdeps) {
+            departure *grown = realloc(q->deps, s->numdeps * sizeof(departure));
+            if(grown == NULL)
+                continue;
+
+            q->deps = grown;
+            q->maxdeps = s->numdeps;
+        }
+
+        for(uint32_t j = 0; j < s->numdeps; ++j) {
+            departure *dep = &q->deps[j];
+            char line[sizeof(d[j].line) + 1];
+            char destination[sizeof(d[j].destination) + 1];
+            memcpy(line, d[j].line, sizeof(d[j].line));
+            memcpy(destination, d[j].destination, sizeof(d[j].destination));
+            line[sizeof(d[j].line)] = 0;
+            destination[sizeof(d[j].destination)] = 0;
+
+            dep->line = strtab_intern(line);
+            dep->destination = strtab_intern(destination);
+            dep->arrival = d[j].arrival;
+            dep->direction = d[j].direction;
+        }
+
+        q->numdeps = s->numdeps;
+        q->fetched = s->fetched;
+        ++restored;
+    }
+
+    munmap((void *)map, size);
+
+    return restored;
+}
@@ -0,0 +1,4 @@
+#define SNAPSHOT_DEFAULT_MAX_AGE 900
+
+int snapshot_save(const char *path, const struct departure_query *queries, int nqueries);
+int snapshot_load(const char *path, struct departure_query *queries, int nqueries, time_t max_age);
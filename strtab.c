@@ -0,0 +1,150 @@
+#define _POSIX_C_SOURCE 200112L
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <err.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "strtab.h"
+
+/* The strings are packed into pages that are never moved or freed, and an
+ * ID is the page number and offset of its string. strtab_get is thus a
+ * lookup in a fixed array that needs no lock: a string is written before
+ * its ID is handed out, and whoever passes the ID on to another thread
+ * already synchronizes with it. Interning takes a lock, and a hash table
+ * of IDs. The API uses a few hundred distinct names at most, so the table
+ * is never expected to fill up; when it does, the empty string is used. */
+#define STRTAB_PAGE_BITS 16
+#define STRTAB_PAGE_SIZE (1 << STRTAB_PAGE_BITS)
+#define STRTAB_PAGES 256
+
+struct slot {
+    uint32_t hash;
+    strid id;
+};
+
+static char *pages[STRTAB_PAGES];
+static int npages;
+static size_t page_used = STRTAB_PAGE_SIZE;
+static struct slot *slots;
+static size_t nslots;
+static size_t count;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t
+hash_str(const char *str, size_t len) {
+    uint32_t h = 2166136261u;
+
+    for(size_t i = 0; i < len; ++i)
+        h = (h ^ (unsigned char)str[i]) * 16777619u;
+
+    return h;
+}
+
+static void
+insert(struct slot *table, size_t size, struct slot s) {
+    size_t i = s.hash & (size - 1);
+    while(table[i].id)
+        i = (i + 1) & (size - 1);
+    table[i] = s;
+}
+
+/* Keeps the table at most half full. */
+static int
+reserve(void) {
+    if(2 * (count + 1) <= nslots)
+        return 0;
+
+    size_t size = nslots ? 2 * nslots : 256;
+    struct slot *grown = calloc(size, sizeof(*grown));
+    if(grown == NULL)
+        return -1;
+
+    for(size_t i = 0; i < nslots; ++i)
+        if(slots[i].id)
+            insert(grown, size, slots[i]);
+
+    free(slots);
+    slots = grown;
+    nslots = size;
+
+    return 0;
+}
+
+static strid
+store(const char *str, size_t len) {
+    if(len + 1 > STRTAB_PAGE_SIZE)
+        return 0;
+
+    if(page_used + len + 1 > STRTAB_PAGE_SIZE) {
+        if(npages == STRTAB_PAGES)
+            return 0;
+
+        char *page = malloc(STRTAB_PAGE_SIZE);
+        if(page == NULL)
+            return 0;
+
+        pages[npages++] = page;
+        page_used = 0;
+
+        /* Offset 0 of page 0 would be ID 0. */
+        if(npages == 1)
+            page[page_used++] = 0;
+    }
+
+    char *s = pages[npages - 1] + page_used;
+    memcpy(s, str, len);
+    s[len] = 0;
+
+    strid id = (strid)(npages - 1) << STRTAB_PAGE_BITS | page_used;
+    page_used += len + 1;
+
+    return id;
+}
+
+strid
+strtab_intern(const char *str) {
+    size_t len = strlen(str);
+    if(len == 0)
+        return 0;
+
+    uint32_t hash = hash_str(str, len);
+
+    pthread_mutex_lock(&lock);
+
+    for(size_t i = nslots ? hash & (nslots - 1) : 0; nslots && slots[i].id; i = (i + 1) & (nslots - 1)) {
+        if(slots[i].hash == hash && !strcmp(strtab_get(slots[i].id), str)) {
+            strid id = slots[i].id;
+            pthread_mutex_unlock(&lock);
+            return id;
+        }
+    }
+
+    static int warned;
+    strid id = 0;
+    if(reserve() == 0 && (id = store(str, len)) != 0) {
+        struct slot s = { hash, id };
+        insert(slots, nslots, s);
+        ++count;
+    } else if(!warned) {
+        warnx("string table is full; showing blanks");
+        warned = 1;
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    return id;
+}
+
+const char *
+strtab_get(strid id) {
+    if(id == 0)
+        return "";
+
+    return pages[id >> STRTAB_PAGE_BITS] + (id & (STRTAB_PAGE_SIZE - 1));
+}
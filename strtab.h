@@ -0,0 +1,6 @@
+/* Interned strings. Every distinct line and destination is stored once,
+ * and departures refer to it by number. 0 is the empty string. */
+typedef uint32_t strid;
+
+strid strtab_intern(const char *str);
+const char *strtab_get(strid id);
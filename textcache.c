@@ -0,0 +1,211 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL/SDL.h>
+#include <SDL/SDL_ttf.h>
+
+#include "textcache.h"
+
+#define TEXTCACHE_BUCKETS 1024
+
+/* Rendered strings, already converted to the display format, keyed on
+ * font, string and colors. Entries sit both in a hash bucket chain and in
+ * a least-recently-used list; the tail of that list is evicted whenever
+ * the surfaces exceed the memory budget, unless it was handed out in the
+ * current frame. */
+struct entry {
+    struct entry *bucket_next;
+    struct entry *lru_prev;
+    struct entry *lru_next;
+    unsigned long frame;
+    uint32_t hash;
+    TTF_Font *font;
+    SDL_Color fg;
+    SDL_Color bg;
+    SDL_Surface *surface;
+    size_t bytes;
+    char str[];
+};
+
+struct textcache {
+    struct entry *buckets[TEXTCACHE_BUCKETS];
+    struct entry *lru_head;
+    struct entry *lru_tail;
+    size_t budget;
+    unsigned long frame;
+    int convert;
+    SDL_PixelFormat format;
+    struct textcache_stats stats;
+};
+
+static uint32_t
+hash_key(TTF_Font *font, const char *str, SDL_Color fg, SDL_Color bg) {
+    uint32_t h = 2166136261u;
+
+    for(const unsigned char *c = (const unsigned char *)str; *c; ++c)
+        h = (h ^ *c) * 16777619u;
+
+    uintptr_t f = (uintptr_t)font;
+    h = (h ^ (uint32_t)(f >> 4)) * 16777619u;
+    h = (h ^ (fg.r | fg.g << 8 | fg.b << 16)) * 16777619u;
+    h = (h ^ (bg.r | bg.g << 8 | bg.b << 16)) * 16777619u;
+
+    return h;
+}
+
+static int
+same_color(SDL_Color a, SDL_Color b) {
+    return a.r == b.r && a.g == b.g && a.b == b.b;
+}
+
+static void
+lru_unlink(struct textcache *tc, struct entry *e) {
+    if(e->lru_prev)
+        e->lru_prev->lru_next = e->lru_next;
+    else
+        tc->lru_head = e->lru_next;
+
+    if(e->lru_next)
+        e->lru_next->lru_prev = e->lru_prev;
+    else
+        tc->lru_tail = e->lru_prev;
+}
+
+static void
+lru_push(struct textcache *tc, struct entry *e) {
+    e->lru_prev = NULL;
+    e->lru_next = tc->lru_head;
+
+    if(tc->lru_head)
+        tc->lru_head->lru_prev = e;
+    else
+        tc->lru_tail = e;
+
+    tc->lru_head = e;
+}
+
+static void
+evict(struct textcache *tc, struct entry *e) {
+    struct entry **p = &tc->buckets[e->hash % TEXTCACHE_BUCKETS];
+    while(*p != e)
+        p = &(*p)->bucket_next;
+    *p = e->bucket_next;
+
+    lru_unlink(tc, e);
+
+    tc->stats.bytes -= e->bytes;
+    --tc->stats.entries;
+
+    SDL_FreeSurface(e->surface);
+    free(e);
+}
+
+struct textcache *
+textcache_new(size_t budget) {
+    struct textcache *tc = calloc(1, sizeof(*tc));
+    if(tc)
+        tc->budget = budget;
+
+    return tc;
+}
+
+void
+textcache_free(struct textcache *tc) {
+    if(tc == NULL)
+        return;
+
+    textcache_flush(tc);
+    free(tc);
+}
+
+void
+textcache_set_budget(struct textcache *tc, size_t budget) {
+    tc->budget = budget;
+}
+
+void
+textcache_set_format(struct textcache *tc, const SDL_PixelFormat *format) {
+    tc->convert = format != NULL;
+    if(format)
+        tc->format = *format;
+}
+
+void
+textcache_begin_frame(struct textcache *tc) {
+    ++tc->frame;
+}
+
+void
+textcache_flush(struct textcache *tc) {
+    while(tc->lru_tail)
+        evict(tc, tc->lru_tail);
+}
+
+SDL_Surface *
+textcache_render(struct textcache *tc, TTF_Font *font, const char *str, SDL_Color fg, SDL_Color bg) {
+    uint32_t hash = hash_key(font, str, fg, bg);
+
+    for(struct entry *e = tc->buckets[hash % TEXTCACHE_BUCKETS]; e; e = e->bucket_next) {
+        if(e->hash == hash && e->font == font && same_color(e->fg, fg) && same_color(e->bg, bg) && !strcmp(e->str, str)) {
+            ++tc->stats.hits;
+            e->frame = tc->frame;
+            lru_unlink(tc, e);
+            lru_push(tc, e);
+            return e->surface;
+        }
+    }
+
+    ++tc->stats.misses;
+
+    SDL_Surface *text = TTF_RenderUTF8_Shaded(font, str, fg, bg);
+    if(text == NULL)
+        return NULL;
+
+    SDL_Surface *converted = tc->convert ? SDL_ConvertSurface(text, &tc->format, 0) : NULL;
+    if(converted) {
+        SDL_FreeSurface(text);
+        text = converted;
+    }
+
+    size_t len = strlen(str);
+    struct entry *e = malloc(sizeof(*e) + len + 1);
+    if(e == NULL) {
+        SDL_FreeSurface(text);
+        return NULL;
+    }
+
+    e->frame = tc->frame;
+    e->hash = hash;
+    e->font = font;
+    e->fg = fg;
+    e->bg = bg;
+    e->surface = text;
+    e->bytes = (size_t)text->pitch * text->h;
+    memcpy(e->str, str, len + 1);
+
+    e->bucket_next = tc->buckets[hash % TEXTCACHE_BUCKETS];
+    tc->buckets[hash % TEXTCACHE_BUCKETS] = e;
+    lru_push(tc, e);
+
+    tc->stats.bytes += e->bytes;
+    ++tc->stats.entries;
+
+    /* Entries are moved to the head when they are handed out, so once the
+     * tail is in use this frame, every entry is. */
+    while(tc->stats.bytes > tc->budget && tc->lru_tail->frame != tc->frame) {
+        evict(tc, tc->lru_tail);
+        ++tc->stats.evictions;
+    }
+
+    return text;
+}
+
+void
+textcache_get_stats(const struct textcache *tc, struct textcache_stats *s) {
+    *s = tc->stats;
+}
@@ -0,0 +1,30 @@
+#define TEXTCACHE_DEFAULT_BUDGET (16 << 20)
+
+/* A cache is not locked; every thread that draws text needs its own.
+ * A surface textcache_render returns stays valid until the next
+ * textcache_begin_frame or textcache_flush, however many more are
+ * rendered meanwhile, so a frame may briefly hold more than the budget. */
+struct textcache;
+
+struct textcache *textcache_new(size_t budget);
+void textcache_free(struct textcache *tc);
+void textcache_set_budget(struct textcache *tc, size_t budget);
+
+/* Rendered text is converted to a copy of format, taken by whichever
+ * thread owns the screen, so that the threads drawing text never look at
+ * the screen themselves. With a null format, text is kept as SDL_ttf
+ * renders it. */
+void textcache_set_format(struct textcache *tc, const SDL_PixelFormat *format);
+void textcache_flush(struct textcache *tc);
+void textcache_begin_frame(struct textcache *tc);
+SDL_Surface *textcache_render(struct textcache *tc, TTF_Font *font, const char *str, SDL_Color fg, SDL_Color bg);
+
+struct textcache_stats {
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long evictions;
+    size_t bytes;
+    size_t entries;
+};
+
+void textcache_get_stats(const struct textcache *tc, struct textcache_stats *stats);
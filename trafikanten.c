@@ -3,80 +3,706 @@
 #endif
 
 #include <err.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <curl/curl.h>
 
 #include "json.h"
+#include "metrics.h"
+#include "strtab.h"
 #include "trafikanten.h"
 
+/* Appends a chunk to the body kept for the next response to be compared
+ * with. The buffer grows to fit and is kept between transfers. */
+static int
+body_append(http_buffer *buf, const char *data, size_t size) {
+    if(buf->size + size > buf->body_alloc) {
+        size_t alloc = buf->body_alloc ? buf->body_alloc : 4096;
+        while(alloc < buf->size + size)
+            alloc *= 2;
+
+        char *body = realloc(buf->body, alloc);
+        if(body == NULL)
+            return -1;
+
+        buf->body = body;
+        buf->body_alloc = alloc;
+    }
+
+    memcpy(buf->body + buf->size, data, size);
+
+    return 0;
+}
+
+static void
+body_parse(http_buffer *buf, const char *data, size_t size) {
+    if(buf->failed)
+        return;
+
+    unsigned long long start = metrics_clock();
+
+    if(json_binder_feed(buf->binder, data, size) == -1) {
+        warnx("fill_buffer: malformed response after %zd bytes", buf->size);
+        buf->failed = 1;
+    }
+
+    buf->parse_ns += metrics_clock() - start;
+}
+
+/* A body is held back from the binder for as long as it matches the
+ * station's previous body byte for byte. The first chunk that differs
+ * releases what was held back, and from then on each chunk is bound
+ * straight into departures as curl receives it. A body that matches to
+ * its end is never parsed at all. */
 static size_t
 fill_buffer(void *ptr, size_t size, size_t nmemb, void *data) {
     size_t realsize = nmemb * size;
     http_buffer *buf = (http_buffer *)data;
 
-    if(buf->size + realsize > HTTP_MAX_BUFFER_SIZE) {
-        warnx("fill_buffer: too much data: realsize=%zd", realsize);
+    if(body_append(buf, ptr, realsize) == -1)
         return 0;
+
+    if(buf->matching && (buf->size + realsize > buf->previous_size || memcmp(buf->previous + buf->size, ptr, realsize))) {
+        buf->matching = 0;
+        body_parse(buf, buf->body, buf->size);
     }
 
-    memcpy(buf->data + buf->size, ptr, realsize);
     buf->size += realsize;
-    buf->data[buf->size] = 0;
+
+    if(!buf->matching)
+        body_parse(buf, ptr, realsize);
 
     return realsize;
 }
 
+/* Keeps the ETag of the response, to be sent back as If-None-Match. */
+static size_t
+fill_header(char *ptr, size_t size, size_t nmemb, void *data) {
+    size_t realsize = nmemb * size;
+    http_buffer *buf = (http_buffer *)data;
+    static const char name[] = "etag:";
+
+    if(realsize < sizeof(name))
+        return realsize;
+    for(size_t i = 0; i < sizeof(name) - 1; ++i)
+        if((ptr[i] | 0x20) != name[i])
+            return realsize;
+
+    size_t start = sizeof(name) - 1;
+    size_t end = realsize;
+    while(start < end && (ptr[start] == ' ' || ptr[start] == '\t'))
+        ++start;
+    while(end > start && (ptr[end - 1] == '\r' || ptr[end - 1] == '\n' || ptr[end - 1] == ' '))
+        --end;
+
+    if(end - start < sizeof(buf->etag)) {
+        memcpy(buf->etag, ptr + start, end - start);
+        buf->etag[end - start] = 0;
+    }
+
+    return realsize;
+}
+
+static struct trafikanten_stats stats;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* A departure as the API sends it. The binder fills one of these at a
+ * time, and it is interned into the list once the next one starts. */
+struct departure_text {
+    char line[DEPARTURE_LINE_SIZE];
+    int direction;
+    char destination[DEPARTURE_DESTINATION_SIZE];
+    time_t arrival;
+};
+
+/* Where the binder puts the departures of one response. */
+struct departure_list {
+    departure **deps;
+    size_t *maxdeps;
+    int grow;
+    size_t count;
+    struct departure_text text;
+};
+
+static void
+departure_intern(struct departure_list *list) {
+    if(list->count == 0 || list->count > *list->maxdeps)
+        return;
+
+    departure *dep = &(*list->deps)[list->count - 1];
+    dep->arrival = list->text.arrival;
+    dep->direction = list->text.direction;
+    dep->line = strtab_intern(list->text.line);
+    dep->destination = strtab_intern(list->text.destination);
+}
+
+static void *
+departure_element(void *record, size_t index) {
+    struct departure_list *list = record;
+
+    departure_intern(list);
+    list->count = index + 1;
+
+    if(index >= *list->maxdeps && list->grow) {
+        size_t maxdeps = *list->maxdeps ? *list->maxdeps * 2 : 16;
+        departure *grown = realloc(*list->deps, maxdeps * sizeof(departure));
+        if(grown == NULL)
+            list->grow = 0;
+        else {
+            *list->deps = grown;
+            *list->maxdeps = maxdeps;
+        }
+    }
+
+    if(index >= *list->maxdeps)
+        return NULL;
+
+    memset(&list->text, 0, sizeof(list->text));
+
+    return &list->text;
+}
+
+static const struct json_field departure_fields[] = {
+    JSON_FIELD(struct departure_text, destination, json_field_text, "DestinationName"),
+    JSON_FIELD(struct departure_text, direction, json_field_int, "DirectionRef"),
+    JSON_FIELD(struct departure_text, line, json_field_text, "LineRef"),
+    JSON_FIELD(struct departure_text, arrival, json_field_time, "ExpectedArrivalTime"),
+};
+
+static struct json_schema departure_schema = {
+    .fields = departure_fields,
+    .nfields = sizeof(departure_fields) / sizeof(departure_fields[0]),
+};
+
+static const struct json_field departure_array = {
+    .type = json_field_array,
+    .schema = &departure_schema,
+    .element = departure_element,
+};
+
+/* Starts binding the departures of the next response into *deps as it
+ * arrives. With grow set, *deps is enlarged with realloc when the
+ * response has more than *maxdeps departures; otherwise the excess is
+ * dropped. */
+static void
+start_departures(http_buffer *buf, departure **deps, size_t *maxdeps, int grow) {
+    memset(buf->list, 0, sizeof(*buf->list));
+    buf->list->deps = deps;
+    buf->list->maxdeps = maxdeps;
+    buf->list->grow = grow;
+
+    json_binder_start(buf->binder, &departure_array, buf->list);
+}
+
+/* Ends the binding of a whole response. Returns how many departures it
+ * had, or -1 if the body could not be decoded, in which case *deps may
+ * hold part of it. */
 static int
-http_get(http_buffer *buf, char *url) {
+parse_departures(const struct station *station, http_buffer *buf) {
+    unsigned long long start = metrics_clock();
+    struct departure_list *list = buf->list;
+
+    if(json_binder_finish(buf->binder, NULL) == -1) {
+        warnx("parse_departures: %s: malformed response of %zd bytes", station->id, buf->size);
+        metrics_count(METRICS_MALFORMED_RESPONSES, 1);
+
+        pthread_mutex_lock(&pool_lock);
+        ++stats.parse_errors;
+        pthread_mutex_unlock(&pool_lock);
+
+        return -1;
+    }
+
+    departure_intern(list);
+
+    if(list->count > *list->maxdeps) {
+        metrics_count(METRICS_TRUNCATED_RESPONSES, 1);
+        list->count = *list->maxdeps;
+    }
+
+    metrics_observe(METRICS_JSON_PARSE, buf->parse_ns + metrics_clock() - start);
+
+    return list->count;
+}
+
+#define API_PATH "/RealTime/GetRealTimeData/"
+
+/* Every request is given up once it has taken this long, so that one
+ * hung connection cannot hold up a whole round of fetches. */
+static long connect_timeout = HTTP_CONNECT_TIMEOUT_MS;
+static long total_timeout = HTTP_TIMEOUT_MS;
+
+void
+trafikanten_set_timeouts(long connect_ms, long total_ms) {
+    connect_timeout = connect_ms > 0 ? connect_ms : HTTP_CONNECT_TIMEOUT_MS;
+    total_timeout = total_ms > 0 ? total_ms : HTTP_TIMEOUT_MS;
+}
+
+const char *
+trafikanten_result_name(enum trafikanten_result result) {
+    switch(result) {
+    case TRAFIKANTEN_OK:
+        return "ok";
+    case TRAFIKANTEN_TIMEOUT:
+        return "timeout";
+    case TRAFIKANTEN_TRANSFER_ERROR:
+        return "transfer error";
+    case TRAFIKANTEN_HTTP_ERROR:
+        return "HTTP error";
+    case TRAFIKANTEN_PARSE_ERROR:
+        return "parse error";
+    }
+
+    return "unknown";
+}
+
+/* Leaves room for the path and the longest station ID. */
+static char api_url[HTTP_URL_SIZE - sizeof(API_PATH) - sizeof(((struct station *)0)->id)] = TRAFIKANTEN_DEFAULT_URL;
+
+/* Sets the scheme, host and optional path prefix the request paths are
+ * appended to, e.g. to point the fetcher at a local mock server. */
+int
+trafikanten_set_url(const char *url) {
+    size_t n = strlen(url);
+    while(n && url[n - 1] == '/')
+        --n;
+
+    if(n >= sizeof(api_url))
+        return -1;
+
+    memcpy(api_url, url, n);
+    api_url[n] = 0;
+
+    return 0;
+}
+
+static void
+station_url(char *url, const struct station *station) {
+    snprintf(url, HTTP_URL_SIZE, "%s" API_PATH "%s", api_url, station->id);
+}
+
+/* Easy handles are kept in a free list instead of being cleaned up after
+ * each request, and all of them share one DNS and connection cache, so
+ * that consecutive requests to the API reuse a warm keep-alive connection. */
+static CURLSH *share;
+static CURLM *multi;
+static CURL *idle_handles[HTTP_POOL_SIZE];
+static int nidle;
+
+static pthread_mutex_t multi_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t share_locks[CURL_LOCK_DATA_LAST];
+
+static void
+share_lock(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr) {
+    handle = handle;
+    access = access;
+    userptr = userptr;
+
+    pthread_mutex_lock(&share_locks[data]);
+}
+
+static void
+share_unlock(CURL *handle, curl_lock_data data, void *userptr) {
+    handle = handle;
+    userptr = userptr;
+
+    pthread_mutex_unlock(&share_locks[data]);
+}
+
+static CURL *
+http_handle(http_buffer *buf, char *url) {
     buf->size = 0;
+    buf->failed = 0;
+    buf->matching = 0;
+    buf->previous = NULL;
+    buf->previous_size = 0;
+    buf->parse_ns = 0;
+    buf->etag[0] = 0;
+
+    CURL *curl_handle = NULL;
+
+    pthread_mutex_lock(&pool_lock);
+    if(nidle)
+        curl_handle = idle_handles[--nidle];
+    pthread_mutex_unlock(&pool_lock);
+
+    if(curl_handle == NULL) {
+        curl_handle = curl_easy_init();
+        if(curl_handle == NULL)
+            return NULL;
+
+        curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, fill_buffer);
+        curl_easy_setopt(curl_handle, CURLOPT_HEADERFUNCTION, fill_header);
+        curl_easy_setopt(curl_handle, CURLOPT_FILETIME, 1L);
+        curl_easy_setopt(curl_handle, CURLOPT_USERAGENT, HTTP_USERAGENT);
+        curl_easy_setopt(curl_handle, CURLOPT_ACCEPT_ENCODING, "");
+        curl_easy_setopt(curl_handle, CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(curl_handle, CURLOPT_DNS_CACHE_TIMEOUT, HTTP_DNS_CACHE_TIMEOUT);
+        curl_easy_setopt(curl_handle, CURLOPT_NOSIGNAL, 1L);
+        if(share)
+            curl_easy_setopt(curl_handle, CURLOPT_SHARE, share);
+    }
 
-    CURL *curl_handle = curl_easy_init();
     curl_easy_setopt(curl_handle, CURLOPT_URL, url);
-    curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, fill_buffer);
+    curl_easy_setopt(curl_handle, CURLOPT_CONNECTTIMEOUT_MS, connect_timeout);
+    curl_easy_setopt(curl_handle, CURLOPT_TIMEOUT_MS, total_timeout);
     curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, (void *)buf);
-    curl_easy_setopt(curl_handle, CURLOPT_USERAGENT, HTTP_USERAGENT);
-    curl_easy_perform(curl_handle);
-    curl_easy_cleanup(curl_handle);
+    curl_easy_setopt(curl_handle, CURLOPT_HEADERDATA, (void *)buf);
+    curl_easy_setopt(curl_handle, CURLOPT_HTTPHEADER, (struct curl_slist *)NULL);
+    curl_easy_setopt(curl_handle, CURLOPT_TIMECONDITION, (long)CURL_TIMECOND_NONE);
+
+    return curl_handle;
+}
+
+static enum trafikanten_result
+http_result(CURLcode result, long code) {
+    if(result == CURLE_OPERATION_TIMEDOUT)
+        return TRAFIKANTEN_TIMEOUT;
+    if(result != CURLE_OK)
+        return TRAFIKANTEN_TRANSFER_ERROR;
+    if(code >= 400)
+        return TRAFIKANTEN_HTTP_ERROR;
+
+    return TRAFIKANTEN_OK;
+}
+
+static void
+http_release(CURL *curl_handle, const http_buffer *buf, enum trafikanten_result result) {
+    long code = 0;
+    long connects = 0;
+    curl_off_t wire = 0;
+    curl_off_t total = 0;
+    curl_easy_getinfo(curl_handle, CURLINFO_RESPONSE_CODE, &code);
+    curl_easy_getinfo(curl_handle, CURLINFO_TOTAL_TIME_T, &total);
+    curl_easy_getinfo(curl_handle, CURLINFO_NUM_CONNECTS, &connects);
+    curl_easy_getinfo(curl_handle, CURLINFO_SIZE_DOWNLOAD_T, &wire);
+
+    pthread_mutex_lock(&pool_lock);
+
+    ++stats.requests;
+    if(code == 0 || code >= 400)
+        ++stats.failed;
+    if(result == TRAFIKANTEN_TIMEOUT)
+        ++stats.timeouts;
+    else if(result == TRAFIKANTEN_HTTP_ERROR)
+        ++stats.http_errors;
+    if(code && connects)
+        stats.connects += connects;
+    else if(code)
+        ++stats.reused;
+    stats.wire_bytes += wire;
+    stats.body_bytes += buf->size;
+
+    if(nidle < HTTP_POOL_SIZE) {
+        idle_handles[nidle++] = curl_handle;
+        curl_handle = NULL;
+    }
+
+    pthread_mutex_unlock(&pool_lock);
+
+    if(code)
+        metrics_observe(METRICS_HTTP_REQUEST, total * 1000ULL);
+
+    if(curl_handle)
+        curl_easy_cleanup(curl_handle);
+}
+
+static enum trafikanten_result
+http_get(http_buffer *buf, char *url) {
+    CURL *curl_handle = http_handle(buf, url);
+    if(curl_handle == NULL)
+        return TRAFIKANTEN_TRANSFER_ERROR;
+
+    long code = 0;
+    CURLcode ret = curl_easy_perform(curl_handle);
+    curl_easy_getinfo(curl_handle, CURLINFO_RESPONSE_CODE, &code);
+
+    enum trafikanten_result result = http_result(ret, code);
+    http_release(curl_handle, buf, result);
+
+    return result;
+}
+
+int
+trafikanten_init(void) {
+    if(json_schema_compile(&departure_schema) == -1)
+        return -1;
+
+    if(curl_global_init(CURL_GLOBAL_ALL) != CURLE_OK)
+        return -1;
+
+    for(size_t i = 0; i < CURL_LOCK_DATA_LAST; ++i)
+        pthread_mutex_init(&share_locks[i], NULL);
+
+    share = curl_share_init();
+    if(share == NULL)
+        return -1;
+
+    curl_share_setopt(share, CURLSHOPT_LOCKFUNC, share_lock);
+    curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+
+    multi = curl_multi_init();
+    if(multi == NULL)
+        return -1;
+
+    curl_multi_setopt(multi, CURLMOPT_MAXCONNECTS, (long)HTTP_POOL_SIZE);
+
+    return 0;
+}
+
+void
+trafikanten_get_stats(struct trafikanten_stats *s) {
+    pthread_mutex_lock(&pool_lock);
+    *s = stats;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+void
+trafikanten_print_stats(FILE *f) {
+    struct trafikanten_stats s;
+    trafikanten_get_stats(&s);
+
+    fprintf(f, "requests %llu, failed %llu (%llu timeouts, %llu HTTP errors), %llu parse errors, "
+            "connections reused %llu (%.1f%%), opened %llu, "
+            "%llu bytes on the wire for %llu bytes of JSON (%.1fx)\n",
+            s.requests, s.failed, s.timeouts, s.http_errors, s.parse_errors,
+            s.reused, s.requests ? 100. * s.reused / s.requests : 0., s.connects,
+            s.wire_bytes, s.body_bytes, s.wire_bytes ? (double)s.body_bytes / s.wire_bytes : 0.);
+}
+
+static int
+http_buffer_init(http_buffer *buf) {
+    memset(buf, 0, sizeof(*buf));
+    buf->binder = json_binder_new();
+    buf->list = malloc(sizeof(*buf->list));
+    if(buf->binder == NULL || buf->list == NULL) {
+        json_binder_free(buf->binder);
+        free(buf->list);
+        return -1;
+    }
 
     return 0;
 }
 
+static void
+http_buffer_destroy(http_buffer *buf) {
+    json_binder_free(buf->binder);
+    free(buf->list);
+    free(buf->deps);
+    free(buf->body);
+}
+
+/* Fetches the departures of one station into deps. Returns how many
+ * there were, or -1 if the fetch failed in any way. */
 int
 trafikanten_get_departures(departure *deps, const size_t maxdeps, const struct station *station) {
-    char url[256];
-    sprintf(url, "http://api-test.trafikanten.no/RealTime/GetRealTimeData/%s", station->id);
+    char url[HTTP_URL_SIZE];
+    station_url(url, station);
 
     http_buffer buf;
-    http_get(&buf, url);
+    if(http_buffer_init(&buf) == -1)
+        return -1;
 
-    struct json_value *j = json_decode(buf.data);
+    size_t n_max = maxdeps;
+    start_departures(&buf, &deps, &n_max, 0);
 
-    if (!j)
-        return 0;
+    int n = -1;
+    if(http_get(&buf, url) == TRAFIKANTEN_OK)
+        n = parse_departures(station, &buf);
 
-    size_t i = 0;
-    for(struct json_value *n = j->v.array; n && i < maxdeps; n = n->next, ++i) {
-        for(struct json_node *m = n->v.object; m; m = m->next) {
-            if(!strcmp(m->name, "DestinationName"))
-              strcpy(deps[i].destination, m->value->v.string);
-            else if(!strcmp(m->name, "DirectionRef"))
-              deps[i].direction = strtol(m->value->v.string, 0, 0);
-            else if(!strcmp(m->name, "LineRef"))
-              strcpy(deps[i].line, m->value->v.string);
-            else if(!strcmp(m->name, "ExpectedArrivalTime")) {
-                long long int t;
-                sscanf(m->value->v.string, "/Date(%lld+%*04d)/", &t);
-                deps[i].arrival = t / 1000;
-            }
+    http_buffer_destroy(&buf);
+
+    return n;
+}
+
+/* The If-None-Match header of a transfer, as a list of one that is
+ * rewritten for every request instead of being allocated by
+ * curl_slist_append. */
+struct request_header {
+    struct curl_slist item;
+    char text[HTTP_ETAG_SIZE + 16];
+};
+
+/* Fetch the departures of every query concurrently over the shared curl
+ * multi handle, and parse each response as it completes. Every query
+ * that was not skipped gets a result; one that is not TRAFIKANTEN_OK also
+ * sets failed, and the query keeps the deps, numdeps and fetched time of
+ * its last successful response. No request takes longer than the total
+ * timeout, so neither does the whole call. Queries with skip set are left
+ * alone. Each query's deps is a malloc'd buffer that grows to fit the
+ * response. Requests are made conditional on the query's last ETag and
+ * Last-Modified time, and a query whose response is 304 Not Modified or
+ * the same as its last body gets unchanged set and is not decoded again.
+ * Each query keeps its last decoded body for this in body, another
+ * malloc'd buffer. Departures are bound as each body arrives, into a
+ * spare array that takes the place of the query's once the whole body
+ * has been bound. The per-transfer binders are kept for the next call. */
+int
+trafikanten_get_departures_all(struct departure_query *queries, const size_t nqueries) {
+    static http_buffer *bufs;
+    static CURL **handles;
+    static struct request_header *headers;
+    static size_t nbufs;
 
-            deps[i].station = station;
+    if(multi == NULL)
+        return -1;
+
+    pthread_mutex_lock(&multi_lock);
+
+    if(nbufs < nqueries) {
+        http_buffer *newbufs = realloc(bufs, nqueries * sizeof *bufs);
+        if(newbufs)
+            bufs = newbufs;
+
+        CURL **newhandles = realloc(handles, nqueries * sizeof *handles);
+        if(newhandles)
+            handles = newhandles;
+
+        struct request_header *newheaders = realloc(headers, nqueries * sizeof *headers);
+        if(newheaders)
+            headers = newheaders;
+
+        while(newbufs && newhandles && newheaders && nbufs < nqueries && http_buffer_init(&bufs[nbufs]) == 0)
+            ++nbufs;
+
+        if(nbufs < nqueries) {
+            pthread_mutex_unlock(&multi_lock);
+            return -1;
         }
     }
 
-    json_free(j);
+    for(size_t i = 0; i < nqueries; ++i) {
+        handles[i] = NULL;
+        if(queries[i].skip)
+            continue;
 
-    return i;
+        char url[HTTP_URL_SIZE];
+        station_url(url, queries[i].station);
+
+        queries[i].result = TRAFIKANTEN_TRANSFER_ERROR;
+        queries[i].failed = 1;
+        queries[i].unchanged = 0;
+        handles[i] = http_handle(&bufs[i], url);
+        if(handles[i] == NULL)
+            continue;
+
+        start_departures(&bufs[i], &bufs[i].deps, &bufs[i].maxdeps, 1);
+        bufs[i].previous = queries[i].body;
+        bufs[i].previous_size = queries[i].body_size;
+        bufs[i].matching = queries[i].body_size != 0;
+
+        if(queries[i].etag[0]) {
+            struct request_header *h = &headers[i];
+            snprintf(h->text, sizeof(h->text), "If-None-Match: %s", queries[i].etag);
+            h->item.data = h->text;
+            h->item.next = NULL;
+            curl_easy_setopt(handles[i], CURLOPT_HTTPHEADER, &h->item);
+        }
+        if(queries[i].modified) {
+            curl_easy_setopt(handles[i], CURLOPT_TIMECONDITION, (long)CURL_TIMECOND_IFMODSINCE);
+            curl_easy_setopt(handles[i], CURLOPT_TIMEVALUE, (long)queries[i].modified);
+        }
+
+        curl_easy_setopt(handles[i], CURLOPT_PRIVATE, (void *)&queries[i]);
+        curl_multi_add_handle(multi, handles[i]);
+    }
+
+    int still_running;
+    do {
+        if(curl_multi_perform(multi, &still_running) != CURLM_OK)
+            break;
+
+        CURLMsg *msg;
+        int msgs_left;
+        while((msg = curl_multi_info_read(multi, &msgs_left))) {
+            if(msg->msg != CURLMSG_DONE)
+                continue;
+
+            struct departure_query *q;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&q);
+            size_t i = q - queries;
+
+            long code = 0;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &code);
+
+            q->result = http_result(msg->data.result, code);
+            if(q->result == TRAFIKANTEN_HTTP_ERROR)
+                warnx("trafikanten_get_departures_all: %s: HTTP status %ld", q->station->id, code);
+            else if(q->result != TRAFIKANTEN_OK)
+                warnx("trafikanten_get_departures_all: %s: %s", q->station->id, curl_easy_strerror(msg->data.result));
+            else {
+                long modified = -1;
+                curl_easy_getinfo(msg->easy_handle, CURLINFO_FILETIME, &modified);
+
+                if(code == 304 || (bufs[i].matching && bufs[i].size == q->body_size)) {
+                    metrics_count(code == 304 ? METRICS_NOT_MODIFIED_RESPONSES : METRICS_UNCHANGED_RESPONSES, 1);
+                    q->unchanged = 1;
+                    q->failed = 0;
+                    q->fetched = time(NULL);
+                } else {
+                    /* A body that stopped short of the previous one was
+                     * never released to the binder. */
+                    if(bufs[i].matching)
+                        body_parse(&bufs[i], bufs[i].body, bufs[i].size);
+
+                    /* Bound next to the last good departures, which are
+                     * only replaced once the whole response has been read. */
+                    int n = parse_departures(q->station, &bufs[i]);
+                    if(n == -1)
+                        q->result = TRAFIKANTEN_PARSE_ERROR;
+                    else {
+                        departure *deps = q->deps;
+                        size_t maxdeps = q->maxdeps;
+                        q->deps = bufs[i].deps;
+                        q->maxdeps = bufs[i].maxdeps;
+                        bufs[i].deps = deps;
+                        bufs[i].maxdeps = maxdeps;
+
+                        char *body = q->body;
+                        size_t body_alloc = q->body_alloc;
+                        q->body = bufs[i].body;
+                        q->body_alloc = bufs[i].body_alloc;
+                        q->body_size = bufs[i].size;
+                        bufs[i].body = body;
+                        bufs[i].body_alloc = body_alloc;
+
+                        q->numdeps = n;
+                        q->failed = 0;
+                        q->fetched = time(NULL);
+                    }
+                }
+
+                /* A validator for a body that could not be decoded would
+                 * only get it answered with 304 from now on. */
+                if(q->result == TRAFIKANTEN_OK) {
+                    if(bufs[i].etag[0])
+                        memcpy(q->etag, bufs[i].etag, sizeof(q->etag));
+                    if(modified != -1)
+                        q->modified = modified;
+                }
+            }
+        }
+
+        if(still_running)
+            curl_multi_wait(multi, NULL, 0, 1000, NULL);
+    } while(still_running);
+
+    for(size_t i = 0; i < nqueries; ++i) {
+        if(handles[i] == NULL)
+            continue;
+
+        curl_multi_remove_handle(multi, handles[i]);
+        http_release(handles[i], &bufs[i], queries[i].result);
+    }
+
+    pthread_mutex_unlock(&multi_lock);
+
+    return 0;
 }
@@ -1,24 +1,96 @@
-#define HTTP_MAX_BUFFER_SIZE 65536
 #define HTTP_USERAGENT "libtrafikanten/0.1"
+#define HTTP_POOL_SIZE 64
+#define HTTP_URL_SIZE 512
+#define TRAFIKANTEN_DEFAULT_URL "http://api-test.trafikanten.no"
+#define HTTP_DNS_CACHE_TIMEOUT 300L
+#define HTTP_CONNECT_TIMEOUT_MS 3000L
+#define HTTP_TIMEOUT_MS 10000L
 
 typedef struct json_object JSON;
 
-typedef struct {
-    char data[HTTP_MAX_BUFFER_SIZE];
-    size_t size;
-} http_buffer;
+#define HTTP_ETAG_SIZE 128
 
 struct station {
     char id[64];
     unsigned int mintime;
 };
 
+/* Kept small, since boards sort and merge whole arrays of these. The
+ * strings are interned; the station is that of the array. */
 typedef struct {
-    char line[8];
-    int direction;
-    char destination[64];
     time_t arrival;
-    const struct station *station;
+    strid line;
+    strid destination;
+    int direction;
 } departure;
 
+/* The longest line and destination kept from a response. */
+#define DEPARTURE_LINE_SIZE 8
+#define DEPARTURE_DESTINATION_SIZE 64
+
+struct departure_list;
+
+typedef struct {
+    struct json_binder *binder;
+    struct departure_list *list;
+    size_t size;
+    int failed;
+    char *body;
+    size_t body_alloc;
+    const char *previous;
+    size_t previous_size;
+    int matching;
+    unsigned long long parse_ns;
+    char etag[HTTP_ETAG_SIZE];
+    departure *deps;
+    size_t maxdeps;
+} http_buffer;
+
+/* How a fetch ended. On anything but TRAFIKANTEN_OK, the departures of
+ * the last good response are kept. */
+enum trafikanten_result {
+    TRAFIKANTEN_OK,
+    TRAFIKANTEN_TIMEOUT,
+    TRAFIKANTEN_TRANSFER_ERROR,
+    TRAFIKANTEN_HTTP_ERROR,
+    TRAFIKANTEN_PARSE_ERROR
+};
+
+struct trafikanten_stats {
+    unsigned long long requests;
+    unsigned long long failed;
+    unsigned long long timeouts;
+    unsigned long long http_errors;
+    unsigned long long parse_errors;
+    unsigned long long reused;
+    unsigned long long connects;
+    unsigned long long wire_bytes;
+    unsigned long long body_bytes;
+};
+
+int trafikanten_init(void);
+int trafikanten_set_url(const char *url);
+void trafikanten_set_timeouts(long connect_ms, long total_ms);
+const char *trafikanten_result_name(enum trafikanten_result result);
+void trafikanten_get_stats(struct trafikanten_stats *stats);
+void trafikanten_print_stats(FILE *f);
 int trafikanten_get_departures(departure *deps, const size_t maxdeps, const struct station *station);
+
+struct departure_query {
+    const struct station *station;
+    departure *deps;
+    size_t maxdeps;
+    int numdeps;
+    enum trafikanten_result result;
+    int failed;
+    int skip;
+    int unchanged;
+    time_t fetched;
+    char etag[HTTP_ETAG_SIZE];
+    time_t modified;
+    char *body;
+    size_t body_size;
+    size_t body_alloc;
+};
+
+int trafikanten_get_departures_all(struct departure_query *queries, const size_t nqueries);
@@ -1,3 +1,5 @@
+#define _XOPEN_SOURCE 600
+
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
@@ -5,24 +7,47 @@
 #include <assert.h>
 #include <err.h>
 #include <errno.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 
 #include <sys/time.h>
+#ifdef ALLOCTEST
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
 
 #include <SDL/SDL.h>
 #include <SDL/SDL_ttf.h>
 
 #include "json.h"
+#include "metrics.h"
+#include "textcache.h"
+#include "strtab.h"
 #include "trafikanten.h"
+#include "snapshot.h"
+#include "shmboard.h"
+
+#ifdef ALLOCTEST
+#include "alloccount.h"
+#endif
 
-#define MAX_CONF_SIZE 1024
 #define DEFAULT_HFONTSIZE 48
 #define DEFAULT_RFONTSIZE 56
 #define DEFAULT_LINEHEIGHT_RATIO 12 / 10
+#define ROW_COLOR_STEPS 16
+#define REFRESH_MIN 5
+#define REFRESH_MAX 300
+#define DEFAULT_REQUESTS_PER_STATION 3
+#define BREAKER_THRESHOLD 5
+#define BREAKER_COOLDOWN (2 * REFRESH_MAX)
+#define BANDS_PER_BLOCK 4
+#define RENDER_THREADS_MAX (2 * BANDS_PER_BLOCK)
 
 #define ARRAY_SIZE(array) (sizeof(array) / sizeof(array[0]))
 
@@ -34,364 +59,2601 @@ static const int update_interval = 10;
 static SDL_Surface *screen;
 static TTF_Font *hfont;
 static TTF_Font *rfont;
-static struct station stations[64];
 static int nstations;
-static departure deps[256];
-static departure adeps[64];
-static departure bdeps[64];
-static int anumdeps;
-static int bnumdeps;
 static int sw;
 static int sh;
-static char fontpath[256];
+static char *fontpath;
+static char *fontdata;
+static size_t fontdatasize;
 static int hfontsize = DEFAULT_HFONTSIZE;
 static int hlineheight = DEFAULT_HFONTSIZE * DEFAULT_LINEHEIGHT_RATIO;
 static int rfontsize = DEFAULT_RFONTSIZE;
 static int rlineheight = DEFAULT_RFONTSIZE * DEFAULT_LINEHEIGHT_RATIO;
 static int marginleft;
 static int odinmode;
+static char *snapshotpath;
+static int snapshotmaxage = SNAPSHOT_DEFAULT_MAX_AGE;
+static int requestbudget;
+static const char *config_path;
+static volatile sig_atomic_t reload_requested;
+static volatile sig_atomic_t dump_requested;
+
+/* With -f, the segment every board is published to; nothing is drawn.
+ * With -r, the name of the segment boards are taken from; nothing is
+ * fetched. */
+static struct shmboard *publish_to;
+static const char *export_path;
+static int headless;
+static const char *render_from_name;
+static struct shmboard *render_from;
+static char *metricssocket;
+
+/* Everything a configuration file sets. configure() fills one without
+ * touching the running program, so that reloading a broken file keeps the
+ * current settings. */
+struct config {
+    char *fontpath;
+    int hfontsize;
+    int rfontsize;
+    int marginleft;
+    int odinmode;
+    size_t textcachesize;
+    int renderthreads;
+    char *snapshotpath;
+    int snapshotmaxage;
+    char *metricssocket;
+    int requestbudget;
+    char *apiurl;
+    double connecttimeout;
+    double fetchtimeout;
+    struct station *stations;
+    int nstations;
+};
+
+/* The departures of one station in one direction, sorted by arrival. A
+ * run is immutable once built, and shared by every board that shows it;
+ * refs is only touched by the fetch thread. */
+struct run {
+    int refs;
+    unsigned long serial;
+    struct run *next_free;
+    const struct station *station;
+    int capacity;
+    int numdeps;
+    departure deps[];
+};
+
+struct board {
+    int nstations;
+    int capacity;
+    struct run **runs[2];
+};
+
+/* Triple buffer between the fetch thread and the renderer: the fetcher
+ * fills back and swaps it with ready, draw() swaps ready with front. Neither
+ * side ever waits for the other to finish with a board. */
+static struct board boards[3];
+static struct board *front = &boards[0];
+static struct board *ready = &boards[1];
+static struct board *back = &boards[2];
+static int board_fresh;
+static pthread_mutex_t board_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t board_cond = PTHREAD_COND_INITIALIZER;
+
+static void
+publish_board(void) {
+    pthread_mutex_lock(&board_lock);
+
+    struct board *tmp = ready;
+    ready = back;
+    back = tmp;
+    board_fresh = 1;
+    pthread_cond_signal(&board_cond);
+
+    pthread_mutex_unlock(&board_lock);
+}
 
 static int
-depsort(const void *a, const void *b) {
-    departure *depa = (departure *) a;
-    departure *depb = (departure *) b;
+take_board(void) {
+    if(pthread_mutex_trylock(&board_lock))
+        return 0;
+
+    int fresh = board_fresh;
+    if(fresh) {
+        struct board *tmp = front;
+        front = ready;
+        ready = tmp;
+        board_fresh = 0;
+    }
 
-    return depa->arrival - depb->arrival;
+    pthread_mutex_unlock(&board_lock);
+
+    return fresh;
 }
 
+/* Sleeps until the given time, or until a fresh board is published. */
 static void
-update_rows(void) {
-    static int station = 0;
-    static int numdeps = 0;
+wait_board(const struct timespec *until) {
+    pthread_mutex_lock(&board_lock);
+    while(!board_fresh && pthread_cond_timedwait(&board_cond, &board_lock, until) != ETIMEDOUT)
+        ;
+    pthread_mutex_unlock(&board_lock);
+}
 
-    int i;
-    for(i = 0; i < numdeps;) {
-        if(deps[i].station == &stations[station])
-            deps[i] = deps[--numdeps];
-        else
-            ++i;
+/* With -t, how long each phase of startup took is written to stderr. */
+static int tracing;
+static unsigned long long trace_start;
+
+static void
+trace(const char *phase) {
+    if(tracing)
+        fprintf(stderr, "%8.1f ms  %s\n", (metrics_clock() - trace_start) / 1e6, phase);
+}
+
+/* Released runs are kept for reuse, so that once the runs have grown to
+ * the size of the responses, updates no longer allocate. */
+static struct run *free_runs;
+
+static void
+run_unref(struct run *run) {
+    if(run && --run->refs == 0) {
+        run->next_free = free_runs;
+        free_runs = run;
     }
+}
+
+/* Collects the departures in one direction into a new run. The API
+ * returns them nearly sorted, so insertion sort is close to linear. */
+static struct run *
+make_run(const struct station *station, const departure *deps, int numdeps, int direction) {
+    struct run *run;
+    struct run **p = &free_runs;
+
+    while(*p && (*p)->capacity < numdeps)
+        p = &(*p)->next_free;
+
+    if(*p) {
+        run = *p;
+        *p = run->next_free;
+    } else {
+        /* Rounded up, so that released runs fit later responses that
+         * are a little longer. */
+        int capacity = 16;
+        while(capacity < numdeps)
+            capacity *= 2;
 
-    int n = trafikanten_get_departures(&deps[numdeps], ARRAY_SIZE(deps) - numdeps, &stations[station]);
-    if(n == -1)
-        err(1, "trafikanten_get_departures");
+        run = malloc(sizeof(*run) + capacity * sizeof(departure));
+        if(run == NULL)
+            err(1, "cannot allocate departures");
 
-    numdeps += n;
+        run->capacity = capacity;
+    }
+
+    static unsigned long serial;
 
-    qsort(deps, numdeps, sizeof(departure), depsort);
+    run->refs = 1;
+    run->serial = ++serial;
+    run->station = station;
+    run->numdeps = 0;
 
-    anumdeps = 0;
-    bnumdeps = 0;
     for(int i = 0; i < numdeps; ++i) {
-        if(deps[i].direction == 1)
-            adeps[anumdeps++] = deps[i];
-        else if(deps[i].direction == 2)
-            bdeps[bnumdeps++] = deps[i];
+        if(deps[i].direction != direction)
+            continue;
+
+        int j = run->numdeps++;
+        for(; j > 0 && run->deps[j - 1].arrival > deps[i].arrival; --j)
+            run->deps[j] = run->deps[j - 1];
+        run->deps[j] = deps[i];
+    }
+
+    return run;
+}
+
+static int
+same_run(const struct run *a, const struct run *b) {
+    if(a == NULL || b == NULL || a->station != b->station || a->numdeps != b->numdeps)
+        return 0;
+
+    for(int i = 0; i < a->numdeps; ++i) {
+        const departure *x = &a->deps[i];
+        const departure *y = &b->deps[i];
+
+        if(x->arrival != y->arrival || x->line != y->line || x->destination != y->destination)
+            return 0;
     }
 
-    station = (station + 1) % nstations;
+    return 1;
 }
 
+/* Makes room for n stations on a board, and drops the runs of the
+ * stations past n. Only ever called on back. */
 static void
-format_time(char *str, time_t dt) {
-    assert (dt >= 0);
+board_resize(struct board *board, int n) {
+    for(int dir = 0; dir < 2; ++dir) {
+        if(board->capacity < n) {
+            struct run **grown = realloc(board->runs[dir], n * sizeof(*grown));
+            if(grown == NULL)
+                err(1, "cannot allocate boards");
+
+            memset(&grown[board->capacity], 0, (n - board->capacity) * sizeof(*grown));
+            board->runs[dir] = grown;
+        }
 
-    int minutes = dt / 60;
-    int seconds = dt % 60;
+        for(int i = n; i < board->capacity; ++i) {
+            run_unref(board->runs[dir][i]);
+            board->runs[dir][i] = NULL;
+        }
+    }
 
-    if(odinmode)
-        sprintf(str, "%d min", minutes);
-    else
-        sprintf(str, "%2d:%02d", minutes, seconds);
+    if(board->capacity < n)
+        board->capacity = n;
 }
 
-static SDL_Color
-row_color(time_t dt, time_t min_time) {
-    time_t max_time = 3 * min_time;
+/* When each station is due for a refresh, how often it has been
+ * refreshed lately, and how many fetches in a row have failed. */
+struct refresh {
+    time_t due;
+    int interval;
+    int changed;
+    int failures;
+};
+
+/* The last response of every station, the runs built from it, and its
+ * refresh schedule. Only the fetch thread touches these once it has
+ * started. */
+static struct departure_query *queries;
+static struct run **runs[2];
+static struct refresh *refresh;
+
+/* Replaces the runs of the stations whose departures changed, and
+ * publishes a new board if any did, or if force is set. Unchanged runs are
+ * carried over to the next board by pointer, so an update costs nothing
+ * for the stations that stayed the same. Returns whether a board was
+ * published. */
+static int
+merge_queries(int force) {
+    int changed = 0;
+    for(int i = 0; i < nstations; ++i) {
+        if(queries[i].failed || queries[i].skip)
+            continue;
 
-    assert (dt >= min_time);
-    dt -= min_time;
+        refresh[i].changed = 0;
 
-    float h = 1. / 3;
+        /* Nothing to sort or compare when the API sent the same body. */
+        if(queries[i].unchanged)
+            continue;
 
-    if(dt < max_time)
-        h *= ((float)dt / max_time);
+        for(int dir = 0; dir < 2; ++dir) {
+            struct run *run = make_run(queries[i].station, queries[i].deps, queries[i].numdeps, dir + 1);
 
-    float r, g;
+            if(same_run(run, runs[dir][i])) {
+                run_unref(run);
+                continue;
+            }
 
-    if(h < 1. / 6) {
-        r = 1;
-        g = (h - 0. / 6) * 6;
-    } else {
-        r = 1 - (h - 1. / 6) * 6;
-        g = 1;
+            run_unref(runs[dir][i]);
+            runs[dir][i] = run;
+            refresh[i].changed = 1;
+            changed = 1;
+        }
     }
 
-    SDL_Color c = {255 * r, 255 * g, 0};
-    return c;
+    if(!changed && !force)
+        return 0;
+
+    board_resize(back, nstations);
+
+    for(int dir = 0; dir < 2; ++dir) {
+        for(int i = 0; i < nstations; ++i) {
+            if(back->runs[dir][i] == runs[dir][i])
+                continue;
+
+            run_unref(back->runs[dir][i]);
+            back->runs[dir][i] = runs[dir][i];
+            if(runs[dir][i])
+                ++runs[dir][i]->refs;
+        }
+    }
+    back->nstations = nstations;
+
+    publish_board();
+
+    static int overflowed;
+    if(publish_to && shmboard_publish(publish_to, queries, nstations) == -1 && !overflowed) {
+        warnx("board does not fit in shared memory; leaving out departures");
+        overflowed = 1;
+    }
+
+    return 1;
 }
 
+/* Stations by refresh deadline, earliest first. Rebuilt whenever the
+ * stations change. */
+static int *schedule;
+static int nscheduled;
+
 static int
-time_width(void) {
-    static int result = 0;
-    if(result)
-        return result;
-    SDL_Color dummy_color;
-    SDL_Surface *text = TTF_RenderUTF8_Shaded(rfont, "00:00", dummy_color, dummy_color);
-    result = text->w;
-    SDL_FreeSurface(text);
-    return result;
+schedule_before(int a, int b) {
+    return refresh[schedule[a]].due < refresh[schedule[b]].due;
 }
 
 static void
-draw_text(char *str, int x, int y, TTF_Font *font, SDL_Color color, int rightalign) {
-    SDL_Surface *text = TTF_RenderUTF8_Shaded(font, str, color, bg);
+schedule_swap(int a, int b) {
+    int tmp = schedule[a];
+    schedule[a] = schedule[b];
+    schedule[b] = tmp;
+}
 
-    SDL_Rect pos = {x, y};
-    if(rightalign)
-        pos.x -= text->w;
+static void
+schedule_push(int station) {
+    int i = nscheduled++;
+    schedule[i] = station;
 
-    SDL_BlitSurface(text, NULL, screen, &pos);
-    SDL_FreeSurface(text);
+    while(i > 0 && schedule_before(i, (i - 1) / 2)) {
+        schedule_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static int
+schedule_pop(void) {
+    int station = schedule[0];
+    schedule[0] = schedule[--nscheduled];
+
+    for(int i = 0;;) {
+        int min = i;
+        int l = 2 * i + 1;
+        int r = l + 1;
+
+        if(l < nscheduled && schedule_before(l, min))
+            min = l;
+        if(r < nscheduled && schedule_before(r, min))
+            min = r;
+        if(min == i)
+            break;
+
+        schedule_swap(i, min);
+        i = min;
+    }
+
+    return station;
 }
 
 static void
-draw_clock(void) {
-    time_t t = time(NULL);
-    struct tm *tmp = localtime(&t);
-    if(tmp == NULL)
-        err(1, "localtime");
+schedule_init(void) {
+    free(schedule);
+    schedule = calloc(nstations, sizeof(*schedule));
+    if(nstations && schedule == NULL)
+        err(1, "cannot allocate stations");
+
+    nscheduled = 0;
+    for(int i = 0; i < nstations; ++i)
+        schedule_push(i);
+}
 
-    char str[20];
-    if(strftime(str, sizeof(str), "%H:%M:%S", tmp) == 0)
-        err(1, "strftime");
+static unsigned int jitter_seed;
 
-    draw_text(str, sw, 0, hfont, fg, 1);
+/* Waits between 1/2 and 1 times wait, so that stations that failed
+ * together do not all retry in the same second. */
+static time_t
+jitter(time_t wait) {
+    return wait / 2 + rand_r(&jitter_seed) % (wait - wait / 2 + 1);
 }
 
+/* The wait after a failed fetch doubles with every failure in a row. From
+ * BREAKER_THRESHOLD failures on, the station's circuit is open: it is
+ * left alone for BREAKER_COOLDOWN, then tried once, and a failure opens
+ * the circuit again. A dead station thus costs one request per cooldown. */
 static void
-draw_headline(char *str, int y) {
-    draw_text(str, marginleft, y, hfont, fg, 0);
+reschedule_failed(int i, time_t now) {
+    struct refresh *r = &refresh[i];
+    const struct departure_query *q = &queries[i];
+    time_t wait;
+
+    if(++r->failures >= BREAKER_THRESHOLD) {
+        if(r->failures == BREAKER_THRESHOLD) {
+            warnx("%s: %d fetches in a row failed (last: %s); trying every %d seconds",
+                  q->station->id, r->failures, trafikanten_result_name(q->result), BREAKER_COOLDOWN);
+            metrics_count(METRICS_CIRCUITS_OPENED, 1);
+        }
+
+        wait = BREAKER_COOLDOWN;
+    } else
+        wait = REFRESH_MIN << (r->failures - 1);
+
+    r->due = now + jitter(wait);
+    schedule_push(i);
 }
 
+/* Picks the next refresh of a station that was just fetched, as the mean
+ * of two waits. One follows how much the responses change: it halves each
+ * time the departures changed and grows by half each time they did not.
+ * The other is half the time until the next departure leaves the board,
+ * so that rows get fresher as they come close. */
 static void
-draw_row(departure *dep, int y, time_t now) {
-    int dt = dep->arrival - now;
+reschedule(int i, time_t now) {
+    struct refresh *r = &refresh[i];
 
-    SDL_Color color = row_color(dt, dep->station->mintime);
+    if(queries[i].failed) {
+        reschedule_failed(i, now);
+        return;
+    }
 
-    char time[8];
-    format_time(time, dt);
-    if(odinmode)
-        draw_text(time, marginleft, y, rfont, color, 0);
+    if(r->failures >= BREAKER_THRESHOLD)
+        warnx("%s: fetching again after %d failures", queries[i].station->id, r->failures);
+    r->failures = 0;
+
+    if(!r->interval)
+        r->interval = update_interval;
     else
-        draw_text(time, marginleft + time_width(), y, rfont, color, 1);
+        r->interval = r->changed ? r->interval / 2 : r->interval * 3 / 2;
+
+    if(r->interval < REFRESH_MIN)
+        r->interval = REFRESH_MIN;
+    else if(r->interval > REFRESH_MAX)
+        r->interval = REFRESH_MAX;
+
+    time_t lead = REFRESH_MAX * 2;
+    for(int k = 0; k < queries[i].numdeps; ++k) {
+        time_t t = queries[i].deps[k].arrival - now - queries[i].station->mintime;
 
-    draw_text(dep->line, marginleft + 8 * rfontsize, y, rfont, color, 1);
-    draw_text(dep->destination, marginleft + 9 * rfontsize, y, rfont, color, 0);
+        if(t >= 0 && t < lead)
+            lead = t;
+    }
+
+    time_t wait = (r->interval + lead / 2) / 2;
+    if(wait < REFRESH_MIN)
+        wait = REFRESH_MIN;
+    else if(wait > REFRESH_MAX)
+        wait = REFRESH_MAX;
+
+    r->due = now + wait;
+    schedule_push(i);
 }
 
+/* Requests may be made at requestbudget per minute on average, in bursts
+ * of up to half a minute's worth. */
+static double tokens = -1;
+static time_t tokens_refilled;
+
 static void
-draw(void) {
-    SDL_FillRect(screen, &screen->clip_rect, 0);
+refill_tokens(time_t now) {
+    double burst = requestbudget / 2.;
 
-    draw_clock();
+    if(tokens < 0)
+        tokens = burst;
+    else
+        tokens += (now - tokens_refilled) * requestbudget / 60.;
+
+    if(tokens > burst)
+        tokens = burst;
+    tokens_refilled = now;
+}
 
-    time_t now = time(NULL);
+/* When the fetch thread next has work, as long as nothing is reloaded. */
+static time_t
+next_refresh(time_t now) {
+    if(nscheduled == 0)
+        return now + REFRESH_MAX;
 
-    draw_headline("Eastbound", 0);
-    for(int i = 0, y = hlineheight; y < sh / 2 - rlineheight && i < anumdeps; ++i) {
-        if(adeps[i].arrival < now + adeps[i].station->mintime)
-            continue;
+    time_t due = refresh[schedule[0]].due;
 
-        draw_row(&adeps[i], y, now);
-        y += rlineheight;
+    if(tokens < 1) {
+        time_t refilled = now + (time_t)((1 - tokens) * 60 / requestbudget) + 1;
+        if(refilled > due)
+            due = refilled;
     }
 
-    draw_headline("Westbound", sh / 2);
-    for(int i = 0, y = sh / 2 + hlineheight; y < sh - rlineheight && i < bnumdeps; ++i) {
-        if(bdeps[i].arrival < now + bdeps[i].station->mintime)
-            continue;
+    return due;
+}
 
-        draw_row(&bdeps[i], y, now);
-        y += rlineheight;
+/* Formats the metrics that belong to the fetch thread: the HTTP totals
+ * and what each station returned last. */
+static void
+fetch_metrics(void) {
+    static char *text;
+    static size_t size;
+
+    if(size < 4096 + (size_t)nstations * 512) {
+        char *grown = realloc(text, 4096 + (size_t)nstations * 512);
+        if(grown == NULL)
+            return;
+
+        text = grown;
+        size = 4096 + (size_t)nstations * 512;
     }
 
-    SDL_Flip(screen);
+    struct trafikanten_stats st;
+    trafikanten_get_stats(&st);
+
+    const struct {
+        const char *name;
+        const char *help;
+        unsigned long long value;
+    } totals[] = {
+        { "vestli_http_requests_total", "Requests made.", st.requests },
+        { "vestli_http_failed_total", "Requests that got no response.", st.failed },
+        { "vestli_http_timeouts_total", "Requests given up after the fetch timeout.", st.timeouts },
+        { "vestli_http_errors_total", "Requests answered with an HTTP error status.", st.http_errors },
+        { "vestli_http_parse_errors_total", "Responses that could not be decoded.", st.parse_errors },
+        { "vestli_http_connections_opened_total", "Connections opened.", st.connects },
+        { "vestli_http_connections_reused_total", "Requests sent over a kept-alive connection.", st.reused },
+        { "vestli_http_wire_bytes_total", "Bytes received, before decompression.", st.wire_bytes },
+        { "vestli_http_body_bytes_total", "Bytes of JSON received.", st.body_bytes },
+    };
+
+    size_t len = 0;
+    for(size_t i = 0; i < ARRAY_SIZE(totals); ++i)
+        len += snprintf(text + len, size - len, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n",
+                        totals[i].name, totals[i].help, totals[i].name, totals[i].name, totals[i].value);
+
+    len += snprintf(text + len, size - len, "# HELP vestli_station_departures Departures in the last response from a station.\n"
+                    "# TYPE vestli_station_departures gauge\n");
+    for(int i = 0; i < nstations; ++i)
+        len += snprintf(text + len, size - len, "vestli_station_departures{station=\"%s\"} %d\n",
+                        queries[i].station->id, queries[i].numdeps);
+
+    len += snprintf(text + len, size - len, "# HELP vestli_station_failures Fetches in a row that failed for a station.\n"
+                    "# TYPE vestli_station_failures gauge\n");
+    for(int i = 0; i < nstations; ++i)
+        len += snprintf(text + len, size - len, "vestli_station_failures{station=\"%s\"} %d\n",
+                        queries[i].station->id, refresh[i].failures);
+
+    len += snprintf(text + len, size - len, "# HELP vestli_station_fetched_seconds Time of the last response from a station.\n"
+                    "# TYPE vestli_station_fetched_seconds gauge\n");
+    for(int i = 0; i < nstations; ++i)
+        len += snprintf(text + len, size - len, "vestli_station_fetched_seconds{station=\"%s\"} %lld\n",
+                        queries[i].station->id, (long long)queries[i].fetched);
+
+    metrics_set_extra(text);
 }
 
+/* Fetches the stations that are due, as many as the request budget
+ * allows, and schedules their next refresh. */
 static void
-configure(const char *path) {
-    FILE *f = fopen(path, "r");
-    if(f == NULL)
-        err(1, "cannot open configuration file \"%s\"", path);
-
-    char buf[MAX_CONF_SIZE + 1];
-    int nmemb = fread(buf, 1, MAX_CONF_SIZE, f);
-    if(ferror(f))
-        err(1, "cannot read configure file \"%s\"", path);
-    buf[nmemb] = 0;
-
-    int ret = fclose(f);
-    if(ret == -1)
-        err(1, "cannot close configure file \"%s\"", path);
-
-    struct json_value *j;
-
-    j = json_decode(buf);
-    if(j == NULL)
-        (errno ? err : errx)(1, "json_decode of \"%s\" failed", path);
-
-    if(j->type != json_object)
-        errx(1, "\"%s\" is not a JSON object", path);
-
-    for(struct json_node *n = j->v.object; n; n = n->next) {
-        if(!strcmp(n->name, "FontPath") && n->value->type == json_string) {
-            strcpy(fontpath, n->value->v.string);
-        } else if(!strcmp(n->name, "HeadFontSize") && n->value->type == json_number) {
-            hfontsize = (int)n->value->v.number;
-            hlineheight = hfontsize * 12 / 10;
-        } else if(!strcmp(n->name, "RowFontSize") && n->value->type == json_number) {
-            rfontsize = (int)n->value->v.number;
-            rlineheight = rfontsize * 12 / 10;
-        } else if(!strcmp(n->name, "MarginLeft") && n->value->type == json_number) {
-            marginleft = (int)n->value->v.number;
-        } else if(!strcmp(n->name, "OdinMode") && n->value->type == json_boolean) {
-            odinmode = n->value->v.boolean;
-        } else if(!strcmp(n->name, "Stations") && n->value->type == json_array) {
-            for(struct json_value *jstation = n->value->v.array; jstation; jstation = jstation->next, ++nstations) {
-                struct station station;
-                if(jstation->type != json_object)
-                    errx(1, "station %d in \"%s\" is not a JSON object", nstations, path);
-
-                memset(&station, 0, sizeof(station));
-
-                for(struct json_node *m = jstation->v.object; m; m = m->next) {
-                    if(!strcmp(m->name, "ID") && m->value->type == json_string)
-                        strncpy(station.id, m->value->v.string, sizeof(station.id));
-                    else if(!strcmp(m->name, "MinTime") && m->value->type == json_number)
-                        station.mintime = (int)m->value->v.number;
-                }
+update_rows(time_t now) {
+    unsigned long long start = metrics_clock();
 
-                if(!station.id[0])
-                    errx(1, "missing ID for station %d in \"%s\"", nstations, path);
+    refill_tokens(now);
 
-                stations[nstations] = station;
-            }
-        }
+    for(int i = 0; i < nstations; ++i)
+        queries[i].skip = 1;
+
+    int due = 0;
+    while(nscheduled && refresh[schedule[0]].due <= now && tokens >= 1) {
+        queries[schedule_pop()].skip = 0;
+        tokens -= 1;
+        ++due;
     }
 
-    if (!fontpath[0])
-        errx(1, "missing FontPath in \"%s\"", path);
+    if(!due)
+        return;
 
-    json_free(j);
-}
+    if(trafikanten_get_departures_all(queries, nstations) == -1)
+        err(1, "trafikanten_get_departures_all");
 
-static void
-font_init(void) {
-    if(TTF_Init() == -1)
-        err(1, "cannot initialize font library");
+    static int first_done;
+    if(!first_done) {
+        first_done = 1;
+        trace("first fetches done");
+    }
 
-    hfont = TTF_OpenFont(fontpath, hfontsize);
-    if(hfont == NULL)
-        err(1, "cannot load font \"%s\"", fontpath);
+    if(merge_queries(0) && snapshotpath && snapshot_save(snapshotpath, queries, nstations) == -1)
+        warn("cannot write snapshot \"%s\"", snapshotpath);
 
-    rfont = TTF_OpenFont(fontpath, rfontsize);
-    if(rfont == NULL)
-        err(1, "cannot load font \"%s\"", fontpath);
+    now = time(NULL);
+    for(int i = 0; i < nstations; ++i)
+        if(!queries[i].skip)
+            reschedule(i, now);
+
+    metrics_observe(METRICS_UPDATE, metrics_clock() - start);
+    fetch_metrics();
 }
 
+/* Shows the departures saved by a previous run until the first fetch
+ * completes, for the stations whose snapshot is recent enough. */
 static void
-screen_init() {
-    SDL_Init(SDL_INIT_TIMER | SDL_INIT_VIDEO);
-
-    const SDL_VideoInfo *info = SDL_GetVideoInfo();
-    if(info == NULL)
-        err(1, "SDL_GetVideoInfo");
+warm_start(void) {
+    if(snapshotpath == NULL)
+        return;
 
-    sw = info->current_w;
-    sh = info->current_h;
+    int restored = snapshot_load(snapshotpath, queries, nstations, snapshotmaxage);
+    if(restored <= 0)
+        return;
 
-    screen = SDL_SetVideoMode(sw, sh, 0, SDL_RESIZABLE);
-    if(!screen)
-        err(1, "cannot initialize screen");
+    for(int i = 0; i < nstations; ++i)
+        queries[i].failed = !queries[i].fetched;
 
-    SDL_ShowCursor(SDL_DISABLE);
+    merge_queries(0);
+    trace("snapshot restored");
 }
 
-static void
-handle_events(void) {
-    SDL_Event event;
+/* Station records are never freed or changed, since runs on boards that
+ * are still being drawn point at them. A station whose settings change
+ * gets a new record, and one that is dropped and added back with the
+ * same settings gets its old record again, so reloading does not grow
+ * the list. */
+static struct station **known_stations;
+static int nknown_stations;
+
+static struct station *
+station_intern(const struct station *station) {
+    for(int i = 0; i < nknown_stations; ++i) {
+        if(!strcmp(known_stations[i]->id, station->id) && known_stations[i]->mintime == station->mintime)
+            return known_stations[i];
+    }
 
-    while (SDL_PollEvent(&event)) {
-        switch (event.type) {
-        case SDL_KEYDOWN:
-            if (event.key.keysym.sym == SDLK_ESCAPE)
-                running = 0;
+    struct station **grown = realloc(known_stations, (nknown_stations + 1) * sizeof(*grown));
+    if(grown == NULL)
+        err(1, "cannot allocate stations");
+    known_stations = grown;
 
-            break;
-        case SDL_VIDEORESIZE:
-            sw = event.resize.w;
-            sh = event.resize.h;
-            break;
-        case SDL_QUIT:
-            exit (EXIT_SUCCESS);
-            break;
-        default:
+    struct station *copy = malloc(sizeof(*copy));
+    if(copy == NULL)
+        err(1, "cannot allocate stations");
+    *copy = *station;
+
+    return known_stations[nknown_stations++] = copy;
+}
+
+/* Takes over the stations, snapshot settings and API URL of c. Stations that were
+ * already configured keep their departures and runs, and only the new
+ * ones start out empty. Returns whether the list of stations changed. */
+static int
+apply_fetch(struct config *c) {
+    struct departure_query *newqueries = calloc(c->nstations, sizeof(*newqueries));
+    struct refresh *newrefresh = calloc(c->nstations, sizeof(*newrefresh));
+    struct run **newruns[2];
+    newruns[0] = calloc(c->nstations, sizeof(*newruns[0]));
+    newruns[1] = calloc(c->nstations, sizeof(*newruns[1]));
+    if(c->nstations && (newqueries == NULL || newrefresh == NULL || newruns[0] == NULL || newruns[1] == NULL))
+        err(1, "cannot allocate stations");
+
+    int changed = c->nstations != nstations;
+    for(int i = 0; i < c->nstations; ++i) {
+        struct station *station = station_intern(&c->stations[i]);
+
+        if(i >= nstations || queries[i].station != station)
+            changed = 1;
+
+        newqueries[i].station = station;
+        for(int j = 0; j < nstations; ++j) {
+            if(queries[j].station == NULL || strcmp(queries[j].station->id, station->id))
+                continue;
+
+            newqueries[i] = queries[j];
+            newqueries[i].station = station;
+            newrefresh[i] = refresh[j];
+
+            /* A new record means new settings, which the runs must show
+             * before the station is next fetched. */
+            for(int dir = 0; dir < 2; ++dir) {
+                newruns[dir][i] = runs[dir][j];
+                runs[dir][j] = NULL;
+                if(newruns[dir][i] && queries[j].station != station) {
+                    run_unref(newruns[dir][i]);
+                    newruns[dir][i] = make_run(station, queries[j].deps, queries[j].numdeps, dir + 1);
+                }
+            }
+            memset(&queries[j], 0, sizeof(queries[j]));
             break;
         }
     }
-}
 
-static int program_argc;
-static char **program_argv;
+    for(int j = 0; j < nstations; ++j) {
+        free(queries[j].deps);
+        free(queries[j].body);
+        run_unref(runs[0][j]);
+        run_unref(runs[1][j]);
+    }
 
-void
-restart(int signal) {
-    signal = signal;
+    free(queries);
+    free(refresh);
+    free(runs[0]);
+    free(runs[1]);
+    queries = newqueries;
+    refresh = newrefresh;
+    runs[0] = newruns[0];
+    runs[1] = newruns[1];
+    nstations = c->nstations;
+
+    schedule_init();
+
+    requestbudget = c->requestbudget ? c->requestbudget : DEFAULT_REQUESTS_PER_STATION * nstations;
+    if(requestbudget < 1)
+        requestbudget = 1;
 
-    char **argv = calloc(program_argc + 1, sizeof *argv);
-    memcpy(argv, program_argv, program_argc * sizeof *argv);
+    free(snapshotpath);
+    snapshotpath = c->snapshotpath;
+    c->snapshotpath = NULL;
+    snapshotmaxage = c->snapshotmaxage;
 
-    extern char **environ;
-    execve(BINDIR "/" PROGRAM_NAME, argv, environ);
+    if(trafikanten_set_url(c->apiurl ? c->apiurl : TRAFIKANTEN_DEFAULT_URL) == -1)
+        warnx("ApiUrl is too long; keeping the current one");
+    trafikanten_set_timeouts(c->connecttimeout * 1000, c->fetchtimeout * 1000);
+
+    return changed;
 }
 
-int
-main(int argc, char **argv) {
-    if(argc != 2) {
-        printf("usage: %s <configuration-file>\n", argv[0]);
-        return EXIT_FAILURE;
+/* A reloaded configuration on its way from the main thread to the fetch
+ * thread, which picks it up as soon as its current update is done. */
+static pthread_mutex_t reload_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reload_cond = PTHREAD_COND_INITIALIZER;
+static struct config *pending_config;
+
+static struct config *config_new(void);
+static void config_free(struct config *c);
+
+static void *
+fetch_loop(void *arg) {
+    arg = arg;
+    jitter_seed = time(NULL) ^ getpid();
+
+    pthread_mutex_lock(&reload_lock);
+    while(running) {
+        struct config *c = pending_config;
+        pending_config = NULL;
+        pthread_mutex_unlock(&reload_lock);
+
+        /* Show the new set of stations at once. The ones that were added
+         * are due right away. */
+        if(c && apply_fetch(c))
+            merge_queries(1);
+        config_free(c);
+
+        update_rows(time(NULL));
+
+        struct timespec deadline = {next_refresh(time(NULL)), 0};
+
+        pthread_mutex_lock(&reload_lock);
+        while(running && pending_config == NULL && pthread_cond_timedwait(&reload_cond, &reload_lock, &deadline) != ETIMEDOUT)
+            ;
     }
+    pthread_mutex_unlock(&reload_lock);
 
-    program_argc = argc;
-    program_argv = argv;
-    signal(SIGHUP, restart);
+    return NULL;
+}
 
-    configure(argv[1]);
-    font_init();
-    screen_init();
+/* Takes the board a fetcher published in place of fetching one, whenever
+ * it changed. The stations are those of the fetcher. */
+static void
+attach_board(void) {
+    static struct shmboard_copy copy;
 
-    int last_update = SDL_GetTicks();
-    update_rows();
+    if(render_from == NULL && (render_from = shmboard_open(render_from_name)) == NULL)
+        return;
 
-    while(running) {
-        int lastTick = SDL_GetTicks();
+    int ret = shmboard_read(render_from, &copy);
+    if(ret == -1) {
+        shmboard_close(render_from);
+        render_from = NULL;
+    }
+    if(ret != 1)
+        return;
+
+    int changed = copy.nstations != nstations;
+    for(int i = 0; i < copy.nstations && !changed; ++i)
+        changed = strcmp(copy.stations[i].id, queries[i].station->id) || copy.stations[i].mintime != queries[i].station->mintime;
+
+    if(changed) {
+        struct config *c = config_new();
+        c->stations = malloc(copy.nstations * sizeof(*c->stations) + 1);
+        if(c->stations == NULL)
+            err(1, "cannot allocate stations");
+        memcpy(c->stations, copy.stations, copy.nstations * sizeof(*c->stations));
+        c->nstations = copy.nstations;
+
+        apply_fetch(c);
+        config_free(c);
+    }
+
+    for(int i = 0; i < nstations; ++i) {
+        struct departure_query *q = &queries[i];
+        const struct departure_query *from = &copy.queries[i];
+
+        if(q->maxdeps < (size_t)from->numdeps) {
+            departure *grown = realloc(q->deps, from->numdeps * sizeof(departure));
+            if(grown == NULL)
+                err(1, "cannot allocate departures");
 
-        if(lastTick - last_update > update_interval * 1000) {
-            last_update = SDL_GetTicks();
-            update_rows();
+            q->deps = grown;
+            q->maxdeps = from->numdeps;
         }
 
-        handle_events();
-        draw();
+        for(int j = 0; j < from->numdeps; ++j)
+            q->deps[j] = from->deps[j];
 
-        struct timeval tv;
-        gettimeofday(&tv, 0);
-        tv.tv_sec = 0;
-        usleep(1000000 - tv.tv_usec);
+        q->numdeps = from->numdeps;
+        q->fetched = from->fetched;
+        q->failed = !from->fetched;
+    }
+
+    merge_queries(changed);
+}
+
+static void
+format_time(char *str, time_t dt) {
+    assert (dt >= 0);
+
+    int minutes = dt / 60;
+    int seconds = dt % 60;
+
+    if(odinmode)
+        sprintf(str, "%d min", minutes);
+    else
+        sprintf(str, "%2d:%02d", minutes, seconds);
+}
+
+/* Quantized, so that rows keep hitting the text cache as they count
+ * down: a row takes one of ROW_COLOR_STEPS + 1 colors, from red at step 0
+ * to green at the last. */
+static SDL_Color
+step_color(int step) {
+    float h = 1. / 3;
+    h *= (float)step / ROW_COLOR_STEPS;
+
+    float r, g;
+
+    if(h < 1. / 6) {
+        r = 1;
+        g = (h - 0. / 6) * 6;
+    } else {
+        r = 1 - (h - 1. / 6) * 6;
+        g = 1;
     }
 
+    SDL_Color c = {255 * r, 255 * g, 0};
+    return c;
+}
+
+static SDL_Color
+row_color(time_t dt, time_t min_time) {
+    time_t max_time = 3 * min_time;
+
+    assert (dt >= min_time);
+    dt -= min_time;
+
+    return step_color(dt < max_time ? dt * ROW_COLOR_STEPS / max_time : ROW_COLOR_STEPS);
+}
+
+/* Every font is opened from the copy of the font file in memory, so that
+ * the file is read once however many sizes and render threads use it. */
+static TTF_Font *
+open_font(const char *data, size_t size, int ptsize) {
+    SDL_RWops *rw = SDL_RWFromConstMem(data, size);
+
+    return rw ? TTF_OpenFontRW(rw, 1, ptsize) : NULL;
+}
+
+/* Reset whenever rfont is reopened. */
+static int timewidth;
+
+/* Measured the way draw_glyphs measures the times it draws. */
+static int
+time_width(void) {
+    if(timewidth)
+        return timewidth;
+    if(TTF_SizeUTF8(rfont, "00:00", &timewidth, NULL) == -1)
+        timewidth = 0;
+    return timewidth;
+}
+
+/* Per-run positions of the first departure that has not left yet. Time
+ * only moves forward, so a cursor only ever advances until its run is
+ * replaced, and expiring a departure is amortized constant time. */
+struct cursor {
+    unsigned long serial;
+    int next;
+};
+
+/* Merge position within one run while a block is being filled, and
+ * the departure a row shows. */
+struct head {
+    const struct run *run;
+    int next;
+};
+
+/* Everything draw() puts on screen is a cell that remembers what it last
+ * showed and where. A cell is only erased and redrawn when its text or
+ * color changes, and only the rectangles of redrawn cells are pushed to
+ * the display. */
+struct cell {
+    char text[128];
+    SDL_Color color;
+    SDL_Rect rect;
+};
+
+enum { CELL_TIME, CELL_LINE, CELL_DESTINATION, CELLS_PER_ROW };
+
+/* What draw() spent on each of its parts during one frame. The clocks are
+ * only read in benchmark mode; the byte counts are always kept. Text and
+ * row times are summed over the render workers, so with more than one
+ * they can add up to more than the frame. */
+struct frame_cost {
+    double total;
+    double text;
+    double row;
+    double clock;
+    double compose;
+    double flip;
+    unsigned long long blitted;
+    unsigned long long presented;
+};
+
+/* A surface draw_text() draws into, with the rectangles it changed in
+ * this frame, in the surface's own coordinates. */
+struct canvas {
+    SDL_Surface *surface;
+    SDL_Rect *dirty;
+    int ndirty;
+    int full_repaint;
+    struct frame_cost cost;
+};
+
+/* The rows of each block are cut into a fixed number of bands, and every
+ * band is a region with an off-screen surface of its own. Regions are
+ * drawn by the render workers, which is safe since no two of them share a
+ * surface, a font or a text cache; draw() then copies what changed in
+ * each region into the screen. Which worker draws a region changes
+ * nothing in the picture. */
+struct region {
+    struct canvas canvas;
+    SDL_Rect rect;
+    int dir;
+    int first;
+    int nrows;
+    struct cell *cells;
+};
+
+/* Worker 0 is the thread that calls draw(), and uses rfont and the main
+ * text cache. The others have their own copy of the row font, since
+ * SDL_ttf may not render with one font on two threads. */
+struct worker {
+    pthread_t thread;
+    TTF_Font *font;
+    struct textcache *cache;
+    unsigned long frame;
+};
+
+static struct textcache *textcache;
+static struct canvas screen_canvas;
+static struct cell clock_cell;
+static struct cell *row_cells;
+static SDL_Rect *region_dirty;
+static int rows_per_block;
+static struct head *block_rows;
+static struct region regions[2 * BANDS_PER_BLOCK];
+static int nregions;
+
+static int renderthreads;
+static struct worker workers[RENDER_THREADS_MAX];
+static int nworkers;
+static time_t frame_now;
+static unsigned long pool_frame;
+static int pool_busy;
+static int pool_quit;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_idle = PTHREAD_COND_INITIALIZER;
+
+static int benchmarking;
+static struct frame_cost cost;
+
+/* Set in benchmark mode, so that the board counts down one second per
+ * frame instead of one second per second. */
+static time_t fake_now;
+
+static double
+cost_clock(void) {
+    if(!benchmarking)
+        return 0;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static time_t
+current_time(void) {
+    return fake_now ? fake_now : time(NULL);
+}
+
+static void
+cost_add(struct frame_cost *sum, const struct frame_cost *part) {
+    sum->text += part->text;
+    sum->row += part->row;
+    sum->blitted += part->blitted;
+}
+
+/* The clock and the countdowns change every second, and are put together
+ * from cached glyphs instead of being rendered whole, which would render
+ * and cache a new surface every second. They are the only strings made
+ * of these characters that have a colon in them. */
+static const char glyphs[] = "0123456789: ";
+
+/* Blits str one glyph at a time at pos, and sets pos to the extent of
+ * what was drawn. Each glyph goes where the string renderer would put
+ * it, kerning included: it ends where the string up to it ends, as
+ * TTF_SizeUTF8 measures it. The whole is as wide as the rendered string
+ * would be. Returns -1 if a glyph could not be rendered. */
+static int
+draw_glyphs(struct canvas *canvas, struct textcache *tc, const char *str, SDL_Rect *pos, TTF_Font *font, SDL_Color color, int rightalign) {
+    SDL_Surface *surfaces[sizeof(((struct cell *)0)->text)];
+    int offsets[ARRAY_SIZE(surfaces)];
+    char prefix[ARRAY_SIZE(surfaces) + 1];
+    int n = 0;
+    int w = 0;
+
+    for(; str[n] && n < (int)ARRAY_SIZE(surfaces); ++n) {
+        char glyph[2] = {str[n], 0};
+        if((surfaces[n] = textcache_render(tc, font, glyph, color, bg)) == NULL)
+            return -1;
+
+        prefix[n] = str[n];
+        prefix[n + 1] = 0;
+        if(TTF_SizeUTF8(font, prefix, &w, NULL) == -1)
+            return -1;
+        offsets[n] = w - surfaces[n]->w;
+    }
+
+    if(rightalign)
+        pos->x -= w;
+
+    SDL_Rect extent = {0, 0, 0, 0};
+    for(int i = 0; i < n; ++i) {
+        SDL_Rect at = {pos->x + offsets[i], pos->y, 0, 0};
+        SDL_BlitSurface(surfaces[i], NULL, canvas->surface, &at);
+        canvas->cost.blitted += (unsigned long long)surfaces[i]->w * surfaces[i]->h * surfaces[i]->format->BytesPerPixel;
+
+        if(!at.w)
+            continue;
+        if(!extent.w)
+            extent = at;
+        else {
+            int x1 = extent.x + extent.w > at.x + at.w ? extent.x + extent.w : at.x + at.w;
+            int y1 = extent.y + extent.h > at.y + at.h ? extent.y + extent.h : at.y + at.h;
+            extent.x = extent.x < at.x ? extent.x : at.x;
+            extent.y = extent.y < at.y ? extent.y : at.y;
+            extent.w = x1 - extent.x;
+            extent.h = y1 - extent.y;
+        }
+    }
+
+    *pos = extent;
+    return 0;
+}
+
+/* Renders every glyph into the text caches in each color it can be drawn
+ * in, so that the times never miss the cache. Called whenever the caches
+ * have been flushed. */
+static void
+preload_glyphs(void) {
+    for(const char *c = glyphs; *c; ++c) {
+        char glyph[2] = {*c, 0};
+
+        textcache_render(textcache, hfont, glyph, fg, bg);
+        for(int i = 0; i < nworkers; ++i)
+            for(int step = 0; step <= ROW_COLOR_STEPS; ++step)
+                textcache_render(workers[i].cache, workers[i].font, glyph, step_color(step), bg);
+    }
+}
+
+static void
+layout_init(void) {
+    rows_per_block = sh / 2 / rlineheight + 1;
+
+    free(row_cells);
+    free(region_dirty);
+    free(screen_canvas.dirty);
+    free(block_rows);
+
+    row_cells = calloc(2 * rows_per_block * CELLS_PER_ROW, sizeof(*row_cells));
+    region_dirty = calloc(2 * rows_per_block * CELLS_PER_ROW, sizeof(*region_dirty));
+    screen_canvas.dirty = calloc(2 * rows_per_block * CELLS_PER_ROW + 1, sizeof(*screen_canvas.dirty));
+    block_rows = calloc(2 * rows_per_block, sizeof(*block_rows));
+    if(row_cells == NULL || region_dirty == NULL || screen_canvas.dirty == NULL || block_rows == NULL)
+        err(1, "cannot allocate screen layout");
+
+    screen_canvas.surface = screen;
+    screen_canvas.full_repaint = 1;
+
+    for(int i = 0; i < nregions; ++i)
+        SDL_FreeSurface(regions[i].canvas.surface);
+    nregions = 0;
+
+    /* Only rows that end above the bottom of their block are drawn. */
+    for(int dir = 0; dir < 2; ++dir) {
+        int top = (dir ? sh / 2 : 0) + hlineheight;
+        int bottom = dir ? sh : sh / 2;
+        int rows = bottom - rlineheight > top ? (bottom - rlineheight - top + rlineheight - 1) / rlineheight : 0;
+
+        for(int band = 0; band < BANDS_PER_BLOCK; ++band) {
+            int first = band * rows / BANDS_PER_BLOCK;
+            int end = (band + 1) * rows / BANDS_PER_BLOCK;
+            if(first == end)
+                continue;
+
+            struct region *r = &regions[nregions++];
+            memset(r, 0, sizeof(*r));
+            r->dir = dir;
+            r->first = first;
+            r->nrows = end - first;
+            r->cells = &row_cells[(dir * rows_per_block + first) * CELLS_PER_ROW];
+            r->rect.y = top + first * rlineheight;
+            r->rect.w = sw;
+            r->rect.h = r->nrows * rlineheight;
+            r->canvas.dirty = &region_dirty[(dir * rows_per_block + first) * CELLS_PER_ROW];
+            r->canvas.full_repaint = 1;
+
+            const SDL_PixelFormat *f = screen->format;
+            r->canvas.surface = SDL_CreateRGBSurface(SDL_SWSURFACE, r->rect.w, r->rect.h, f->BitsPerPixel,
+                                                     f->Rmask, f->Gmask, f->Bmask, f->Amask);
+            if(r->canvas.surface == NULL)
+                errx(1, "cannot allocate screen region: %s", SDL_GetError());
+        }
+    }
+
+    preload_glyphs();
+}
+
+static void
+draw_text(struct canvas *canvas, struct textcache *tc, struct cell *cell, const char *str, int x, int y, TTF_Font *font, SDL_Color color, int rightalign) {
+    if(!canvas->full_repaint && !strcmp(cell->text, str) && cell->color.r == color.r && cell->color.g == color.g && cell->color.b == color.b)
+        return;
+
+    double start = cost_clock();
+
+    SDL_Rect old = cell->rect;
+    SDL_Rect pos = {x, y, 0, 0};
+
+    if(!canvas->full_repaint && old.w) {
+        SDL_Rect erase = old;
+        SDL_FillRect(canvas->surface, &erase, 0);
+    }
+
+    if(strchr(str, ':') && !str[strspn(str, glyphs)]) {
+        if(draw_glyphs(canvas, tc, str, &pos, font, color, rightalign) == -1)
+            pos.w = pos.h = 0;
+    } else {
+        SDL_Surface *text = str[0] ? textcache_render(tc, font, str, color, bg) : NULL;
+        if(text) {
+            if(rightalign)
+                pos.x -= text->w;
+
+            SDL_BlitSurface(text, NULL, canvas->surface, &pos);
+            canvas->cost.blitted += (unsigned long long)text->w * text->h * text->format->BytesPerPixel;
+        }
+    }
+
+    snprintf(cell->text, sizeof(cell->text), "%s", str);
+    cell->color = color;
+    cell->rect = pos;
+
+    canvas->cost.text += cost_clock() - start;
+
+    if(canvas->full_repaint)
+        return;
+
+    /* Push the union of the old and the new extent. */
+    if(!old.w)
+        old = pos;
+    else if(pos.w) {
+        int x0 = old.x < pos.x ? old.x : pos.x;
+        int y0 = old.y < pos.y ? old.y : pos.y;
+        int x1 = old.x + old.w > pos.x + pos.w ? old.x + old.w : pos.x + pos.w;
+        int y1 = old.y + old.h > pos.y + pos.h ? old.y + old.h : pos.y + pos.h;
+        old.x = x0;
+        old.y = y0;
+        old.w = x1 - x0;
+        old.h = y1 - y0;
+    }
+
+    if(old.w)
+        canvas->dirty[canvas->ndirty++] = old;
+}
+
+static void
+draw_clock(void) {
+    double start = cost_clock();
+
+    time_t t = current_time();
+    struct tm *tmp = localtime(&t);
+    if(tmp == NULL)
+        err(1, "localtime");
+
+    char str[20];
+    if(strftime(str, sizeof(str), "%H:%M:%S", tmp) == 0)
+        err(1, "strftime");
+
+    draw_text(&screen_canvas, textcache, &clock_cell, str, sw, 0, hfont, fg, 1);
+
+    cost.clock += cost_clock() - start;
+}
+
+static void
+draw_headline(char *str, int y) {
+    struct cell cell;
+    memset(&cell, 0, sizeof(cell));
+
+    draw_text(&screen_canvas, textcache, &cell, str, marginleft, y, hfont, fg, 0);
+}
+
+static void
+draw_row(struct canvas *canvas, struct worker *w, struct cell *cells, const struct head *row, int y, time_t now) {
+    double start = cost_clock();
+
+    if(row->run == NULL) {
+        for(int i = 0; i < CELLS_PER_ROW; ++i)
+            draw_text(canvas, w->cache, &cells[i], "", 0, y, w->font, bg, 0);
+
+        canvas->cost.row += cost_clock() - start;
+        return;
+    }
+
+    const departure *dep = &row->run->deps[row->next];
+    int dt = dep->arrival - now;
+
+    SDL_Color color = row_color(dt, row->run->station->mintime);
+
+    char time[8];
+    format_time(time, dt);
+    if(odinmode)
+        draw_text(canvas, w->cache, &cells[CELL_TIME], time, marginleft, y, w->font, color, 0);
+    else
+        draw_text(canvas, w->cache, &cells[CELL_TIME], time, marginleft + time_width(), y, w->font, color, 1);
+
+    draw_text(canvas, w->cache, &cells[CELL_LINE], strtab_get(dep->line), marginleft + 8 * rfontsize, y, w->font, color, 1);
+    draw_text(canvas, w->cache, &cells[CELL_DESTINATION], strtab_get(dep->destination), marginleft + 9 * rfontsize, y, w->font, color, 0);
+
+    canvas->cost.row += cost_clock() - start;
+}
+
+static void
+draw_region(struct region *r, struct worker *w, time_t now) {
+    struct canvas *canvas = &r->canvas;
+
+    canvas->ndirty = 0;
+    memset(&canvas->cost, 0, sizeof(canvas->cost));
+
+    if(canvas->full_repaint) {
+        SDL_FillRect(canvas->surface, NULL, 0);
+        memset(r->cells, 0, r->nrows * CELLS_PER_ROW * sizeof(*r->cells));
+    }
+
+    for(int i = 0; i < r->nrows; ++i)
+        draw_row(canvas, w, &r->cells[i * CELLS_PER_ROW], &block_rows[r->dir * rows_per_block + r->first + i], i * rlineheight, now);
+}
+
+/* Regions are dealt out round-robin, so that each worker keeps drawing
+ * the same rows and its text cache stays warm. */
+static void
+draw_regions(struct worker *w) {
+    textcache_begin_frame(w->cache);
+    for(int i = w - workers; i < nregions; i += nworkers)
+        draw_region(&regions[i], w, frame_now);
+}
+
+static void *
+render_loop(void *arg) {
+    struct worker *w = arg;
+
+    pthread_mutex_lock(&pool_lock);
+    for(;;) {
+        while(!pool_quit && pool_frame == w->frame)
+            pthread_cond_wait(&pool_wake, &pool_lock);
+        if(pool_quit)
+            break;
+
+        w->frame = pool_frame;
+        pthread_mutex_unlock(&pool_lock);
+
+        draw_regions(w);
+
+        pthread_mutex_lock(&pool_lock);
+        if(--pool_busy == 0)
+            pthread_cond_signal(&pool_idle);
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    return NULL;
+}
+
+/* Starts n - 1 render threads. When a font cannot be opened or a thread
+ * cannot be started, fewer are used; with none at all, the regions are
+ * drawn one after the other on the calling thread. Every text cache gets
+ * its copy of the display format here, on the main thread. */
+static void
+render_start(int n) {
+    workers[0].font = rfont;
+    workers[0].cache = textcache;
+    textcache_set_format(textcache, screen ? screen->format : NULL);
+    nworkers = 1;
+
+    for(int i = 1; i < n; ++i) {
+        struct worker *w = &workers[i];
+
+        w->font = open_font(fontdata, fontdatasize, rfontsize);
+        w->cache = w->font ? textcache_new(TEXTCACHE_DEFAULT_BUDGET) : NULL;
+        w->frame = pool_frame;
+        if(w->cache)
+            textcache_set_format(w->cache, screen ? screen->format : NULL);
+
+        if(w->cache == NULL || pthread_create(&w->thread, NULL, render_loop, w)) {
+            warnx("cannot start render thread %d, using %d", i + 1, i);
+            textcache_free(w->cache);
+            if(w->font)
+                TTF_CloseFont(w->font);
+            break;
+        }
+
+        ++nworkers;
+    }
+}
+
+static void
+render_stop(void) {
+    pthread_mutex_lock(&pool_lock);
+    pool_quit = 1;
+    pthread_cond_broadcast(&pool_wake);
+    pthread_mutex_unlock(&pool_lock);
+
+    for(int i = 1; i < nworkers; ++i) {
+        pthread_join(workers[i].thread, NULL);
+        TTF_CloseFont(workers[i].font);
+        textcache_free(workers[i].cache);
+    }
+
+    pool_quit = 0;
+    nworkers = 1;
+}
+
+/* The text caches are keyed by font, and a new font may well be allocated
+ * where an old one was; they also hold surfaces in the display format,
+ * which is taken again in case a new screen changed it. */
+static void
+render_flush(void) {
+    for(int i = 0; i < nworkers; ++i) {
+        textcache_flush(workers[i].cache);
+        textcache_set_format(workers[i].cache, screen ? screen->format : NULL);
+    }
+}
+
+static void
+render_stats(struct textcache_stats *sum) {
+    memset(sum, 0, sizeof(*sum));
+
+    for(int i = 0; i < nworkers; ++i) {
+        struct textcache_stats s;
+        textcache_get_stats(workers[i].cache, &s);
+
+        sum->hits += s.hits;
+        sum->misses += s.misses;
+        sum->evictions += s.evictions;
+        sum->bytes += s.bytes;
+        sum->entries += s.entries;
+    }
+}
+
+static struct cursor *cursors[2];
+static struct head *heap;
+static int ncursors;
+
+static void
+cursors_resize(int n) {
+    if(n <= ncursors)
+        return;
+
+    struct cursor *grown0 = realloc(cursors[0], n * sizeof(*grown0));
+    if(grown0)
+        cursors[0] = grown0;
+    struct cursor *grown1 = realloc(cursors[1], n * sizeof(*grown1));
+    if(grown1)
+        cursors[1] = grown1;
+    struct head *grownheap = realloc(heap, n * sizeof(*grownheap));
+    if(grownheap)
+        heap = grownheap;
+    if(grown0 == NULL || grown1 == NULL || grownheap == NULL)
+        err(1, "cannot allocate stations");
+
+    memset(&cursors[0][ncursors], 0, (n - ncursors) * sizeof(*cursors[0]));
+    memset(&cursors[1][ncursors], 0, (n - ncursors) * sizeof(*cursors[1]));
+    ncursors = n;
+}
+
+static int
+skip_departed(const struct run *run, int next, time_t now) {
+    time_t earliest = now + run->station->mintime;
+
+    while(next < run->numdeps && run->deps[next].arrival < earliest)
+        ++next;
+
+    return next;
+}
+
+static void
+sift_down(struct head *heap, int n, int i) {
+    for(;;) {
+        int min = i;
+        int l = 2 * i + 1;
+        int r = l + 1;
+
+        if(l < n && heap[l].run->deps[heap[l].next].arrival < heap[min].run->deps[heap[min].next].arrival)
+            min = l;
+        if(r < n && heap[r].run->deps[heap[r].next].arrival < heap[min].run->deps[heap[min].next].arrival)
+            min = r;
+        if(min == i)
+            return;
+
+        struct head tmp = heap[i];
+        heap[i] = heap[min];
+        heap[min] = tmp;
+        i = min;
+    }
+}
+
+/* Picks the earliest visible departures of one direction for the rows of
+ * its block by a k-way merge of the station runs, stopping as soon as the
+ * block is full. Rows left over have no run, and are drawn blank. */
+static void
+fill_block(int dir, time_t now) {
+    struct head *rows = &block_rows[dir * rows_per_block];
+    int n = 0;
+
+    for(int i = 0; i < front->nstations; ++i) {
+        struct cursor *c = &cursors[dir][i];
+        const struct run *run = front->runs[dir][i];
+
+        if(run == NULL)
+            continue;
+
+        if(c->serial != run->serial) {
+            c->serial = run->serial;
+            c->next = 0;
+        }
+
+        c->next = skip_departed(run, c->next, now);
+
+        if(c->next < run->numdeps) {
+            heap[n].run = run;
+            heap[n].next = c->next;
+            ++n;
+        }
+    }
+
+    for(int i = n / 2 - 1; i >= 0; --i)
+        sift_down(heap, n, i);
+
+    int row = 0;
+    for(; row < rows_per_block && n; ++row) {
+        rows[row] = heap[0];
+
+        heap[0].next = skip_departed(heap[0].run, heap[0].next + 1, now);
+        if(heap[0].next == heap[0].run->numdeps)
+            heap[0] = heap[--n];
+
+        sift_down(heap, n, 0);
+    }
+
+    for(; row < rows_per_block; ++row)
+        rows[row].run = NULL;
+}
+
+#define ENCODE_LITERAL(b, s) json_encode_raw((b), (s), sizeof(s) - 1)
+
+/* Appends the departures of one direction that have not left yet, all of
+ * them and by the same merge as fill_block. */
+static int
+encode_direction(struct json_buffer *b, const struct board *board, int dir, time_t now) {
+    int n = 0;
+    for(int i = 0; i < board->nstations; ++i) {
+        const struct run *run = board->runs[dir][i];
+        int next = run ? skip_departed(run, 0, now) : 0;
+
+        if(run && next < run->numdeps) {
+            heap[n].run = run;
+            heap[n].next = next;
+            ++n;
+        }
+    }
+
+    for(int i = n / 2 - 1; i >= 0; --i)
+        sift_down(heap, n, i);
+
+    if(ENCODE_LITERAL(b, "{\"direction\":") == -1 || json_encode_integer(b, dir + 1) == -1
+       || ENCODE_LITERAL(b, ",\"departures\":[") == -1)
+        return -1;
+
+    for(int first = 1; n; first = 0) {
+        const struct run *run = heap[0].run;
+        const departure *d = &run->deps[heap[0].next];
+
+        if((!first && ENCODE_LITERAL(b, ",") == -1)
+           || ENCODE_LITERAL(b, "{\"station\":") == -1 || json_encode_string(b, run->station->id) == -1
+           || ENCODE_LITERAL(b, ",\"line\":") == -1 || json_encode_string(b, strtab_get(d->line)) == -1
+           || ENCODE_LITERAL(b, ",\"destination\":") == -1 || json_encode_string(b, strtab_get(d->destination)) == -1
+           || ENCODE_LITERAL(b, ",\"arrival\":") == -1 || json_encode_integer(b, d->arrival) == -1
+           || ENCODE_LITERAL(b, "}") == -1)
+            return -1;
+
+        heap[0].next = skip_departed(run, heap[0].next + 1, now);
+        if(heap[0].next == run->numdeps)
+            heap[0] = heap[--n];
+
+        sift_down(heap, n, 0);
+    }
+
+    return ENCODE_LITERAL(b, "]}");
+}
+
+/* One line of JSON per board:
+ * {"time":...,"directions":[{"direction":1,"departures":[{"station":...,
+ * "line":...,"destination":...,"arrival":...},...]},{"direction":2,...}]}
+ * with the times in seconds since the epoch. */
+static int
+encode_board(struct json_buffer *b, const struct board *board, time_t now) {
+    cursors_resize(board->nstations);
+
+    return ENCODE_LITERAL(b, "{\"time\":") == -1 || json_encode_integer(b, now) == -1
+           || ENCODE_LITERAL(b, ",\"directions\":[") == -1
+           || encode_direction(b, board, 0, now) == -1 || ENCODE_LITERAL(b, ",") == -1
+           || encode_direction(b, board, 1, now) == -1 || ENCODE_LITERAL(b, "]}\n") == -1 ? -1 : 0;
+}
+
+/* Writes the front board to stdout, or to a temporary file that is then
+ * renamed over export_path, so that readers only ever see a whole
+ * board. */
+static void
+export_board(void) {
+    static struct json_buffer out;
+
+    out.size = 0;
+    if(encode_board(&out, front, time(NULL)) == -1)
+        err(1, "cannot allocate board export");
+
+    if(!strcmp(export_path, "-")) {
+        if(fwrite(out.data, 1, out.size, stdout) != out.size || fflush(stdout))
+            err(1, "cannot write board to stdout");
+        return;
+    }
+
+    char tmp[4096];
+    if(snprintf(tmp, sizeof(tmp), "%s.tmp", export_path) >= (int)sizeof(tmp))
+        errx(1, "export path \"%s\" is too long", export_path);
+
+    FILE *f = fopen(tmp, "wb");
+    if(f == NULL) {
+        warn("cannot write board to \"%s\"", tmp);
+        return;
+    }
+
+    if(fwrite(out.data, 1, out.size, f) != out.size || fclose(f) || rename(tmp, export_path)) {
+        warn("cannot write board to \"%s\"", export_path);
+        unlink(tmp);
+    }
+}
+
+/* Draws every region, on the render threads and this one, and returns
+ * when all of them are done. */
+static void
+draw_rows(time_t now) {
+    frame_now = now;
+
+    if(nworkers == 1) {
+        draw_regions(&workers[0]);
+        return;
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    ++pool_frame;
+    pool_busy = nworkers - 1;
+    pthread_cond_broadcast(&pool_wake);
+    pthread_mutex_unlock(&pool_lock);
+
+    draw_regions(&workers[0]);
+
+    pthread_mutex_lock(&pool_lock);
+    while(pool_busy)
+        pthread_cond_wait(&pool_idle, &pool_lock);
+    pthread_mutex_unlock(&pool_lock);
+}
+
+/* Copies what changed in each region into the screen. */
+static void
+compose(void) {
+    double start = cost_clock();
+
+    for(int i = 0; i < nregions; ++i) {
+        struct region *r = &regions[i];
+        struct canvas *canvas = &r->canvas;
+
+        if(canvas->full_repaint) {
+            SDL_Rect pos = r->rect;
+            SDL_BlitSurface(canvas->surface, NULL, screen, &pos);
+            if(!screen_canvas.full_repaint)
+                screen_canvas.dirty[screen_canvas.ndirty++] = pos;
+        } else {
+            for(int k = 0; k < canvas->ndirty; ++k) {
+                SDL_Rect src = canvas->dirty[k];
+                SDL_Rect pos = { r->rect.x + src.x, r->rect.y + src.y, 0, 0 };
+                SDL_BlitSurface(canvas->surface, &src, screen, &pos);
+                if(pos.w && pos.h)
+                    screen_canvas.dirty[screen_canvas.ndirty++] = pos;
+            }
+        }
+
+        canvas->full_repaint = 0;
+        cost_add(&cost, &canvas->cost);
+    }
+
+    cost.compose += cost_clock() - start;
+}
+
+static int
+board_has_departures(const struct board *b) {
+    for(int dir = 0; dir < 2; ++dir)
+        for(int i = 0; i < b->nstations; ++i)
+            if(b->runs[dir][i] && b->runs[dir][i]->numdeps)
+                return 1;
+
+    return 0;
+}
+
+static void
+draw(void) {
+    if(take_board()) {
+        cursors_resize(front->nstations);
+        screen_canvas.full_repaint = 1;
+    }
+
+    screen_canvas.ndirty = 0;
+    memset(&screen_canvas.cost, 0, sizeof(screen_canvas.cost));
+    textcache_begin_frame(textcache);
+
+    if(screen_canvas.full_repaint) {
+        SDL_FillRect(screen, &screen->clip_rect, 0);
+
+        memset(&clock_cell, 0, sizeof(clock_cell));
+        for(int i = 0; i < nregions; ++i)
+            regions[i].canvas.full_repaint = 1;
+
+        draw_headline("Eastbound", 0);
+        draw_headline("Westbound", sh / 2);
+    }
+
+    draw_clock();
+    cost_add(&cost, &screen_canvas.cost);
+
+    time_t now = current_time();
+
+    fill_block(0, now);
+    fill_block(1, now);
+
+    /* Measured here, so that the workers only ever read it. */
+    if(!odinmode)
+        time_width();
+
+    draw_rows(now);
+    compose();
+
+    double start = cost_clock();
+
+    if(screen_canvas.full_repaint) {
+        SDL_Flip(screen);
+        cost.presented += (unsigned long long)screen->h * screen->pitch;
+    } else if(screen_canvas.ndirty) {
+        SDL_UpdateRects(screen, screen_canvas.ndirty, screen_canvas.dirty);
+        for(int i = 0; i < screen_canvas.ndirty; ++i)
+            cost.presented += (unsigned long long)screen_canvas.dirty[i].w * screen_canvas.dirty[i].h * screen->format->BytesPerPixel;
+    }
+
+    cost.flip += cost_clock() - start;
+
+    screen_canvas.full_repaint = 0;
+}
+
+static struct config *
+config_new(void) {
+    struct config *c = calloc(1, sizeof(*c));
+    if(c == NULL)
+        err(1, "cannot allocate configuration");
+
+    c->hfontsize = DEFAULT_HFONTSIZE;
+    c->rfontsize = DEFAULT_RFONTSIZE;
+    c->textcachesize = TEXTCACHE_DEFAULT_BUDGET;
+    c->snapshotmaxage = SNAPSHOT_DEFAULT_MAX_AGE;
+
+    return c;
+}
+
+static void
+config_free(struct config *c) {
+    if(c == NULL)
+        return;
+
+    free(c->fontpath);
+    free(c->snapshotpath);
+    free(c->metricssocket);
+    free(c->apiurl);
+    free(c->stations);
+    free(c);
+}
+
+static char *
+config_string(const char *path, const char *name, const char *value) {
+    char *copy = malloc(strlen(value) + 1);
+    if(copy == NULL)
+        err(1, "cannot allocate %s in \"%s\"", name, path);
+
+    return strcpy(copy, value);
+}
+
+/* Stations are appended as the array is bound, doubling the allocation
+ * whenever the count reaches a power of two. */
+static void *
+config_station(void *record, size_t index) {
+    struct config *c = record;
+
+    if((index & (index - 1)) == 0) {
+        struct station *stations = realloc(c->stations, (index ? 2 * index : 1) * sizeof(*stations));
+        if(stations == NULL)
+            err(1, "cannot allocate stations");
+        c->stations = stations;
+    }
+
+    c->nstations = index + 1;
+    memset(&c->stations[index], 0, sizeof(c->stations[index]));
+
+    return &c->stations[index];
+}
+
+static const struct json_field station_fields[] = {
+    JSON_FIELD(struct station, id, json_field_string, "ID"),
+    JSON_FIELD(struct station, mintime, json_field_int, "MinTime"),
+};
+
+static struct json_schema station_schema = {
+    .fields = station_fields,
+    .nfields = ARRAY_SIZE(station_fields),
+};
+
+static const struct json_field config_fields[] = {
+    JSON_FIELD(struct config, fontpath, json_field_strdup, "FontPath"),
+    JSON_FIELD(struct config, hfontsize, json_field_int, "HeadFontSize"),
+    JSON_FIELD(struct config, rfontsize, json_field_int, "RowFontSize"),
+    JSON_FIELD(struct config, marginleft, json_field_int, "MarginLeft"),
+    JSON_FIELD(struct config, textcachesize, json_field_size, "TextCacheSize"),
+    JSON_FIELD(struct config, renderthreads, json_field_int, "RenderThreads"),
+    JSON_FIELD(struct config, snapshotpath, json_field_strdup, "SnapshotPath"),
+    JSON_FIELD(struct config, metricssocket, json_field_strdup, "MetricsSocket"),
+    JSON_FIELD(struct config, requestbudget, json_field_int, "RequestBudget"),
+    JSON_FIELD(struct config, apiurl, json_field_strdup, "ApiUrl"),
+    JSON_FIELD(struct config, connecttimeout, json_field_double, "ConnectTimeout"),
+    JSON_FIELD(struct config, fetchtimeout, json_field_double, "FetchTimeout"),
+    JSON_FIELD(struct config, snapshotmaxage, json_field_int, "SnapshotMaxAge"),
+    JSON_FIELD(struct config, odinmode, json_field_boolean, "OdinMode"),
+    { .name = "Stations", .type = json_field_array, .schema = &station_schema, .element = config_station },
+};
+
+static struct json_schema config_schema = {
+    .fields = config_fields,
+    .nfields = ARRAY_SIZE(config_fields),
+};
+
+static const struct json_field config_object = {
+    .type = json_field_object,
+    .schema = &config_schema,
+};
+
+/* Reads a whole file into a malloc'd buffer, with a NUL after its end.
+ * Returns NULL with errno set if it cannot be read. */
+static char *
+read_file(const char *path, size_t *sizep) {
+    FILE *f = fopen(path, "rb");
+    if(f == NULL)
+        return NULL;
+
+    char *text = NULL;
+    size_t size = 0;
+    size_t capacity = 0;
+
+    do {
+        if(size + 1 >= capacity) {
+            capacity = capacity ? capacity * 2 : 4096;
+            char *grown = realloc(text, capacity);
+            if(grown == NULL) {
+                free(text);
+                fclose(f);
+                errno = ENOMEM;
+                return NULL;
+            }
+            text = grown;
+        }
+
+        size += fread(text + size, 1, capacity - size - 1, f);
+    } while(!feof(f) && !ferror(f));
+
+    int failed = ferror(f);
+    if(fclose(f) == -1 || failed) {
+        free(text);
+        return NULL;
+    }
+
+    text[size] = 0;
+    if(sizep)
+        *sizep = size;
+
+    return text;
+}
+
+/* Reads the configuration file into c. Problems with the file are
+ * reported and make it return -1, so that a reload can keep going with
+ * the configuration it has. */
+static int
+configure(const char *path, struct config *c) {
+    if(json_schema_compile(&config_schema) == -1)
+        errx(1, "cannot compile the configuration schema");
+
+    char *text = read_file(path, NULL);
+    if(text == NULL) {
+        warn("cannot read configuration file \"%s\"", path);
+        return -1;
+    }
+
+    int ret = 0;
+    const struct json_field *failed;
+
+    if(json_bind(text, &config_object, c, &failed) == NULL) {
+        if(failed)
+            warnx("invalid %s in \"%s\"", failed->name, path);
+        else
+            warnx("json_decode of \"%s\" failed", path);
+        ret = -1;
+    }
+
+    free(text);
+
+    for(int i = 0; ret == 0 && i < c->nstations; ++i) {
+        if(!c->stations[i].id[0]) {
+            warnx("missing ID for station %d in \"%s\"", i, path);
+            ret = -1;
+        }
+    }
+
+    if(ret == 0 && c->fontpath == NULL) {
+        warnx("missing FontPath in \"%s\"", path);
+        ret = -1;
+    }
+
+    return ret;
+}
+
+static void
+font_init(void) {
+    if(TTF_Init() == -1)
+        err(1, "cannot initialize font library");
+}
+
+/* At startup the font file is read on a thread of its own, while the
+ * screen is being set up. */
+static struct {
+    pthread_t thread;
+    int started;
+    const char *path;
+    char *data;
+    size_t size;
+    int error;
+} font_preload;
+
+static void *
+font_preload_loop(void *arg) {
+    arg = arg;
+
+    font_preload.data = read_file(font_preload.path, &font_preload.size);
+    if(font_preload.data == NULL)
+        font_preload.error = errno;
+
+    return NULL;
+}
+
+static void
+font_preload_start(const char *path) {
+    font_preload.path = path;
+    font_preload.started = !pthread_create(&font_preload.thread, NULL, font_preload_loop, NULL);
+}
+
+/* Reads the font file at path, or takes it from the preload. */
+static char *
+font_read(const char *path, size_t *size) {
+    if(font_preload.started) {
+        pthread_join(font_preload.thread, NULL);
+        font_preload.started = 0;
+
+        if(!strcmp(font_preload.path, path)) {
+            *size = font_preload.size;
+            errno = font_preload.error;
+            return font_preload.data;
+        }
+
+        free(font_preload.data);
+    }
+
+    return read_file(path, size);
+}
+
+/* Takes over the display settings of c. The fonts are only reopened when
+ * the font file or one of the sizes changed, since that is the slow part
+ * of a reload. */
+static int
+apply_display(struct config *c) {
+    int reopened = 0;
+
+    if(hfont == NULL || strcmp(c->fontpath, fontpath) || c->hfontsize != hfontsize || c->rfontsize != rfontsize) {
+        char *data = fontdata;
+        size_t size = fontdatasize;
+        if(fontpath == NULL || strcmp(c->fontpath, fontpath)) {
+            data = font_read(c->fontpath, &size);
+            if(data == NULL) {
+                warn("cannot read font \"%s\"", c->fontpath);
+                return -1;
+            }
+        }
+
+        TTF_Font *h = open_font(data, size, c->hfontsize);
+        TTF_Font *r = h ? open_font(data, size, c->rfontsize) : NULL;
+        if(r == NULL) {
+            warnx("cannot load font \"%s\"", c->fontpath);
+            if(h)
+                TTF_CloseFont(h);
+            if(data != fontdata)
+                free(data);
+            return -1;
+        }
+
+        if(hfont) {
+            render_stop();
+            render_flush();
+            TTF_CloseFont(hfont);
+            TTF_CloseFont(rfont);
+        }
+
+        if(data != fontdata) {
+            free(fontdata);
+            fontdata = data;
+            fontdatasize = size;
+        }
+
+        hfont = h;
+        rfont = r;
+        timewidth = 0;
+        reopened = 1;
+
+        free(fontpath);
+        fontpath = c->fontpath;
+        c->fontpath = NULL;
+
+        hfontsize = c->hfontsize;
+        hlineheight = hfontsize * DEFAULT_LINEHEIGHT_RATIO;
+        rfontsize = c->rfontsize;
+        rlineheight = rfontsize * DEFAULT_LINEHEIGHT_RATIO;
+    }
+
+    marginleft = c->marginleft;
+    odinmode = c->odinmode;
+
+    if(textcache == NULL && (textcache = textcache_new(c->textcachesize)) == NULL)
+        err(1, "cannot allocate text cache");
+
+    /* RenderThreads 0 means one per processor, 1 draws everything on this
+     * thread. */
+    int threads = c->renderthreads;
+    if(threads <= 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if(threads < 1)
+        threads = 1;
+    if(threads > RENDER_THREADS_MAX)
+        threads = RENDER_THREADS_MAX;
+
+    if(reopened || threads != renderthreads) {
+        render_stop();
+        render_start(threads);
+        renderthreads = threads;
+    }
+
+    for(int i = 0; i < nworkers; ++i)
+        textcache_set_budget(workers[i].cache, c->textcachesize / nworkers);
+
+    if(screen)
+        layout_init();
+
+    return 0;
+}
+
+/* Moves the metrics socket when MetricsSocket changed. */
+static void
+apply_metrics(struct config *c) {
+    if(c->metricssocket && metricssocket && !strcmp(c->metricssocket, metricssocket))
+        return;
+
+    if(metrics_listen(c->metricssocket) == -1)
+        warn("cannot listen on \"%s\"", c->metricssocket);
+
+    free(metricssocket);
+    metricssocket = c->metricssocket;
+    c->metricssocket = NULL;
+}
+
+static void
+screen_init() {
+    SDL_Init(SDL_INIT_TIMER | SDL_INIT_VIDEO);
+
+    const SDL_VideoInfo *info = SDL_GetVideoInfo();
+    if(info == NULL)
+        err(1, "SDL_GetVideoInfo");
+
+    sw = info->current_w;
+    sh = info->current_h;
+
+    screen = SDL_SetVideoMode(sw, sh, 0, SDL_RESIZABLE);
+    if(!screen)
+        err(1, "cannot initialize screen");
+
+    SDL_ShowCursor(SDL_DISABLE);
+
+    /* Otherwise apply_display lays out the screen once the fonts are in. */
+    if(hfont)
+        layout_init();
+}
+
+static void
+handle_events(void) {
+    SDL_Event event;
+
+    while (SDL_PollEvent(&event)) {
+        switch (event.type) {
+        case SDL_KEYDOWN:
+            if (event.key.keysym.sym == SDLK_ESCAPE)
+                running = 0;
+
+            break;
+        case SDL_VIDEORESIZE:
+            sw = event.resize.w;
+            sh = event.resize.h;
+
+            screen = SDL_SetVideoMode(sw, sh, 0, SDL_RESIZABLE);
+            if(!screen)
+                err(1, "cannot resize screen");
+
+            render_flush();
+            layout_init();
+            break;
+        case SDL_QUIT:
+            exit (EXIT_SUCCESS);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+static void
+request_reload(int signal) {
+    signal = signal;
+
+    reload_requested = 1;
+}
+
+static void
+request_dump(int signal) {
+    signal = signal;
+
+    dump_requested = 1;
+}
+
+/* Rereads the configuration file after a SIGHUP. The display settings are
+ * applied right here, and the stations are handed to the fetch thread,
+ * which keeps the departures of every station that is still configured.
+ * The screen keeps showing the current board throughout. */
+static void
+reload(void) {
+    struct config *c = config_new();
+    if(configure(config_path, c) == -1 || (!headless && apply_display(c) == -1)) {
+        warnx("keeping the current configuration");
+        config_free(c);
+        return;
+    }
+
+    apply_metrics(c);
+
+    if(render_from_name) {
+        config_free(c);
+        return;
+    }
+
+    pthread_mutex_lock(&reload_lock);
+    config_free(pending_config);
+    pending_config = c;
+    pthread_cond_signal(&reload_cond);
+    pthread_mutex_unlock(&reload_lock);
+}
+
+/* Benchmark mode draws a synthetic board with SDL's dummy video driver
+ * at every combination of the modes and row font sizes below, and writes
+ * one tab-separated line of frame costs for each. The board is republished
+ * every update_interval frames, like the fetch thread would. */
+#define BENCH_STATIONS 24
+#define BENCH_DEPARTURES 60
+
+static const struct {
+    int w;
+    int h;
+} bench_modes[] = {
+    { 1920, 1080 },
+    { 2560, 1440 },
+    { 3840, 2160 },
+    { 2160, 3840 },
+};
+
+static const int bench_font_sizes[] = { 32, 56, 96 };
+
+static const char *const bench_destinations[] = {
+    "Vestli", "Bergkrystallen", "Ringen via Majorstuen", "Sognsvann", "Rikshospitalet",
+    "Grefsen stasjon", "Ljabru", "Storo via Ullevaal sykehus", "Helsfyr T", "Lysaker",
+};
+
+static int
+compare_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static double
+percentile(double *samples, int n, double p) {
+    qsort(samples, n, sizeof(*samples), compare_double);
+
+    return samples[(int)(p * (n - 1))];
+}
+
+static void
+bench_board(void) {
+    struct config *c = config_new();
+    c->nstations = BENCH_STATIONS;
+    c->stations = calloc(BENCH_STATIONS, sizeof(*c->stations));
+    if(c->stations == NULL)
+        err(1, "cannot allocate stations");
+
+    for(int i = 0; i < BENCH_STATIONS; ++i) {
+        snprintf(c->stations[i].id, sizeof(c->stations[i].id), "bench-%d", i);
+        c->stations[i].mintime = 60 * (i % 4);
+    }
+
+    apply_fetch(c);
+    config_free(c);
+
+    for(int i = 0; i < nstations; ++i) {
+        struct departure_query *q = &queries[i];
+
+        if(q->maxdeps < BENCH_DEPARTURES) {
+            departure *grown = realloc(q->deps, BENCH_DEPARTURES * sizeof(*grown));
+            if(grown == NULL)
+                err(1, "cannot allocate departures");
+
+            q->deps = grown;
+            q->maxdeps = BENCH_DEPARTURES;
+        }
+
+        q->numdeps = BENCH_DEPARTURES;
+        q->fetched = fake_now;
+
+        for(int k = 0; k < BENCH_DEPARTURES; ++k) {
+            departure *dep = &q->deps[k];
+            char line[DEPARTURE_LINE_SIZE];
+            snprintf(line, sizeof(line), "%d", (7 * i + k) % 40 + 1);
+
+            dep->line = strtab_intern(line);
+            dep->destination = strtab_intern(bench_destinations[(i + k) % ARRAY_SIZE(bench_destinations)]);
+            dep->direction = 1 + k % 2;
+            dep->arrival = fake_now + 20 + 53 * k + 11 * i;
+        }
+    }
+
+    merge_queries(1);
+}
+
+static void
+bench(struct config *c, int frames) {
+    double *samples = calloc(frames, sizeof(*samples));
+    struct frame_cost *costs = calloc(frames, sizeof(*costs));
+    if(samples == NULL || costs == NULL)
+        err(1, "cannot allocate benchmark samples");
+
+    SDL_putenv("SDL_VIDEODRIVER=dummy");
+    if(SDL_Init(SDL_INIT_VIDEO) == -1)
+        errx(1, "cannot initialize SDL: %s", SDL_GetError());
+
+    benchmarking = 1;
+
+    printf("width\theight\trow_font\trows\tthreads\tframes"
+           "\tframe_p50_ms\tframe_p99_ms\ttext_p50_ms\ttext_p99_ms\trow_p50_ms\trow_p99_ms"
+           "\tclock_p50_ms\tclock_p99_ms\tcompose_p50_ms\tcompose_p99_ms\tflip_p50_ms\tflip_p99_ms"
+           "\tblitted_per_frame\tpresented_per_frame\n");
+
+    for(size_t m = 0; m < ARRAY_SIZE(bench_modes); ++m) {
+        sw = bench_modes[m].w;
+        sh = bench_modes[m].h;
+
+        screen = SDL_SetVideoMode(sw, sh, 0, SDL_SWSURFACE);
+        if(!screen)
+            errx(1, "cannot set %dx%d: %s", sw, sh, SDL_GetError());
+
+        for(size_t f = 0; f < ARRAY_SIZE(bench_font_sizes); ++f) {
+            c->rfontsize = bench_font_sizes[f];
+            c->fontpath = config_string(config_path, "FontPath", fontpath);
+            if(apply_display(c) == -1)
+                exit(EXIT_FAILURE);
+
+            render_flush();
+            fake_now = 1331822700;
+            bench_board();
+
+            unsigned long long blitted = 0;
+            unsigned long long presented = 0;
+
+            for(int i = 0; i < frames; ++i) {
+                if(i && i % update_interval == 0)
+                    merge_queries(1);
+
+                memset(&cost, 0, sizeof(cost));
+                double start = cost_clock();
+                draw();
+                cost.total = cost_clock() - start;
+
+                costs[i] = cost;
+                blitted += cost.blitted;
+                presented += cost.presented;
+                ++fake_now;
+            }
+
+            printf("%d\t%d\t%d\t%d\t%d\t%d", sw, sh, rfontsize, 2 * rows_per_block, nworkers, frames);
+
+            for(int part = 0; part < 6; ++part) {
+                for(int i = 0; i < frames; ++i) {
+                    const struct frame_cost *fc = &costs[i];
+                    double parts[] = { fc->total, fc->text, fc->row, fc->clock, fc->compose, fc->flip };
+                    samples[i] = parts[part] * 1e3;
+                }
+
+                printf("\t%.4f\t%.4f", percentile(samples, frames, .5), percentile(samples, frames, .99));
+            }
+
+            printf("\t%llu\t%llu\n", blitted / frames, presented / frames);
+            fflush(stdout);
+        }
+    }
+
+    free(samples);
+    free(costs);
+}
+
+#ifdef ALLOCTEST
+/* Allocation test, for a build with the counting allocator: runs the
+ * stations of the configuration against the API at api-url, with the
+ * fetch thread scheduling its updates as it would on a real board, and
+ * draws once a second with SDL's dummy video driver. Once TEST_WARMUP
+ * boards have come in and grown every buffer, the next TEST_BOARDS must
+ * neither allocate nor free. The mock API moves its departures along
+ * every second, so every fetch brings a different response, and a
+ * response is only decoded into a buffer after it has been swapped with
+ * the last one. Snapshots are saved to TEST_SNAPSHOT, and the metrics are
+ * read from TEST_SOCKET after every frame. The font is that of the
+ * configuration unless font-file is given; without a font the test is
+ * skipped. */
+#define TEST_WARMUP 12
+#define TEST_BOARDS 12
+#define TEST_TIMEOUT 300
+#define TEST_SNAPSHOT "alloctest.snapshot"
+#define TEST_SOCKET "alloctest.sock"
+
+/* Exit status telling automake that a test was skipped. */
+#define TEST_SKIPPED 77
+
+/* Reads the metrics socket as a scraper would. */
+static void
+test_scrape(void) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, TEST_SOCKET);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+        err(1, "cannot connect to \"%s\"", TEST_SOCKET);
+
+    metrics_serve();
+
+    char text[4096];
+    ssize_t n;
+    size_t total = 0;
+    while((n = read(fd, text, sizeof(text))) > 0)
+        total += n;
+    close(fd);
+
+    if(total == 0)
+        errx(1, "no metrics on \"%s\"", TEST_SOCKET);
+}
+
+/* Draws a frame each second until the given number of boards have been
+ * published, and returns whether they were before the deadline. */
+static int
+test_boards(int boards, time_t deadline) {
+    while(boards > 0) {
+        if(time(NULL) >= deadline)
+            return 0;
+
+        pthread_mutex_lock(&board_lock);
+        boards -= board_fresh;
+        pthread_mutex_unlock(&board_lock);
+
+        draw();
+        test_scrape();
+
+        struct timespec next = {time(NULL) + 1, 0};
+        wait_board(&next);
+    }
+
+    return 1;
+}
+
+static int
+alloc_test(int argc, char **argv) {
+    if(argc != 3 && argc != 4) {
+        fprintf(stderr, "usage: %s api-url configuration-file [font-file]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    config_path = argv[2];
+
+    struct config *c = config_new();
+    if(configure(config_path, c) == -1)
+        return EXIT_FAILURE;
+
+    if(argc == 4) {
+        free(c->fontpath);
+        if((c->fontpath = strdup(argv[3])) == NULL)
+            err(1, "cannot allocate font path");
+    }
+    if(access(c->fontpath, R_OK) == -1) {
+        warn("skipped: cannot read font \"%s\"", c->fontpath);
+        return TEST_SKIPPED;
+    }
+
+    free(c->snapshotpath);
+    free(c->metricssocket);
+    if((c->snapshotpath = strdup(TEST_SNAPSHOT)) == NULL || (c->metricssocket = strdup(TEST_SOCKET)) == NULL)
+        err(1, "cannot allocate test paths");
+    unlink(TEST_SNAPSHOT);
+
+    SDL_putenv("SDL_VIDEODRIVER=dummy");
+    if(SDL_Init(SDL_INIT_VIDEO) == -1)
+        errx(1, "cannot initialize SDL: %s", SDL_GetError());
+
+    sw = 1920;
+    sh = 1080;
+    if((screen = SDL_SetVideoMode(sw, sh, 0, SDL_SWSURFACE)) == NULL)
+        errx(1, "cannot set %dx%d: %s", sw, sh, SDL_GetError());
+
+    font_init();
+    if(apply_display(c) == -1)
+        return EXIT_FAILURE;
+
+    apply_fetch(c);
+    apply_metrics(c);
+    config_free(c);
+    if(trafikanten_init() == -1 || trafikanten_set_url(argv[1]) == -1)
+        errx(1, "cannot initialize HTTP library");
+
+    pthread_t fetcher;
+    if(pthread_create(&fetcher, NULL, fetch_loop, NULL))
+        errx(1, "cannot start fetch thread");
+
+    time_t deadline = time(NULL) + TEST_TIMEOUT;
+    if(!test_boards(TEST_WARMUP, deadline))
+        errx(1, "fewer than %d boards in %d seconds", TEST_WARMUP, TEST_TIMEOUT);
+
+    unsigned long long allocs = alloccount_allocs();
+    unsigned long long frees = alloccount_frees();
+
+    if(!test_boards(TEST_BOARDS, deadline))
+        errx(1, "fewer than %d boards in %d seconds", TEST_WARMUP + TEST_BOARDS, TEST_TIMEOUT);
+
+    allocs = alloccount_allocs() - allocs;
+    frees = alloccount_frees() - frees;
+
+    printf("%d boards after %d to warm up: %llu allocations, %llu frees\n", TEST_BOARDS, TEST_WARMUP, allocs, frees);
+
+    if(access(TEST_SNAPSHOT, R_OK) == -1)
+        err(1, "no snapshot was saved");
+    unlink(TEST_SNAPSHOT);
+    unlink(TEST_SOCKET);
+
+    return allocs || frees ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+#endif
+
+static void
+usage(const char *argv0) {
+    printf("usage: %s [-t] [-b [-n frames] | [-f segment] [-j file] | -r segment] <configuration-file>\n", argv0);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char **argv) {
+#ifdef ALLOCTEST
+    return alloc_test(argc, argv);
+#endif
+
+    int benchmark = 0;
+    int frames = 600;
+
+    const char *publish_name = NULL;
+
+    trace_start = metrics_clock();
+
+    int opt;
+    while((opt = getopt(argc, argv, "bf:j:n:r:t")) != -1) {
+        if(opt == 'b')
+            benchmark = 1;
+        else if(opt == 't')
+            tracing = 1;
+        else if(opt == 'f')
+            publish_name = optarg;
+        else if(opt == 'j')
+            export_path = optarg;
+        else if(opt == 'r')
+            render_from_name = optarg;
+        else if(opt == 'n' && atoi(optarg) > 0)
+            frames = atoi(optarg);
+        else
+            usage(argv[0]);
+    }
+
+    if(optind != argc - 1 || ((publish_name || export_path) && render_from_name))
+        usage(argv[0]);
+
+    /* A fetcher, and the JSON export, never open a window. */
+    headless = publish_name || export_path;
+
+    config_path = argv[optind];
+
+    struct config *c = config_new();
+    if(configure(config_path, c) == -1)
+        return EXIT_FAILURE;
+    trace("configuration read");
+
+    if(benchmark) {
+        font_init();
+        if(apply_display(c) == -1)
+            return EXIT_FAILURE;
+
+        bench(c, frames);
+        config_free(c);
+
+        SDL_Quit();
+        return EXIT_SUCCESS;
+    }
+
+    signal(SIGHUP, request_reload);
+    signal(SIGUSR1, request_dump);
+    signal(SIGPIPE, SIG_IGN);
+
+    if(publish_name && (publish_to = shmboard_create(publish_name)) == NULL)
+        err(1, "cannot create shared board \"%s\"", publish_name);
+
+    /* Startup overlaps: the first fetches and the reading of the font
+     * file go on while the screen is set up, and the first frame is drawn
+     * as soon as there is a screen, then again whenever a board arrives. */
+    if(!headless)
+        font_preload_start(c->fontpath);
+
+    if(render_from_name == NULL) {
+        apply_fetch(c);
+        warm_start();
+
+        if(trafikanten_init() == -1)
+            errx(1, "cannot initialize HTTP library");
+
+        pthread_t fetcher;
+        if(pthread_create(&fetcher, NULL, fetch_loop, NULL))
+            errx(1, "cannot start fetch thread");
+        trace("fetches started");
+    }
+    if(!headless) {
+        screen_init();
+        trace("screen ready");
+
+        font_init();
+        if(apply_display(c) == -1)
+            return EXIT_FAILURE;
+        trace("fonts opened");
+    }
+    apply_metrics(c);
+    config_free(c);
+
+    int traced_frame = 0;
+
+    while(running) {
+        if(reload_requested) {
+            reload_requested = 0;
+            reload();
+        }
+
+        if(dump_requested) {
+            dump_requested = 0;
+            metrics_write(stderr);
+        }
+
+        /* Without a window, there is only the metrics socket to look
+         * after, and the boards to export as they arrive. */
+        if(headless) {
+            if(take_board() && export_path) {
+                export_board();
+                if(traced_frame == 0)
+                    trace("first board exported");
+                traced_frame = 1;
+            }
+
+            metrics_serve();
+
+            struct timespec next = {time(NULL) + 1, 0};
+            wait_board(&next);
+            continue;
+        }
+
+        if(render_from_name)
+            attach_board();
+
+        struct timeval tv;
+        gettimeofday(&tv, 0);
+        time_t second = tv.tv_sec;
+
+        handle_events();
+
+        unsigned long long start = metrics_clock();
+        draw();
+        metrics_observe(METRICS_FRAME, metrics_clock() - start);
+
+        if(tracing && traced_frame < 2) {
+            if(traced_frame == 0)
+                trace("first frame");
+            traced_frame = 1;
+            if(board_has_departures(front)) {
+                trace("first frame with departures");
+                traced_frame = 2;
+            }
+        }
+
+        metrics_serve();
+
+        /* A frame is due at the start of every second; one that ends in
+         * a later second than it started in has made the clock skip. */
+        gettimeofday(&tv, 0);
+        if(tv.tv_sec != second)
+            metrics_count(METRICS_DEADLINE_MISSES, 1);
+
+        struct timespec next = {tv.tv_sec + 1, 0};
+        wait_board(&next);
+    }
+
+    if(render_from_name == NULL)
+        trafikanten_print_stats(stderr);
+
+    struct textcache_stats tc;
+    render_stats(&tc);
+    fprintf(stderr, "text cache hits %llu, misses %llu, evictions %llu, %zu surfaces in %zu bytes\n",
+            tc.hits, tc.misses, tc.evictions, tc.entries, tc.bytes);
+
     SDL_Quit();
     return EXIT_SUCCESS;
 }